@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <compare>
 #include <concepts>
@@ -8,13 +9,18 @@
 #include <cstdint>
 #include <exception>
 #include <filesystem>
+#include <functional>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -130,6 +136,16 @@ namespace bsa
 		compressed
 	};
 
+	/// \brief	Specifies whether an operation may spread its work across multiple threads.
+	enum class execution_policy
+	{
+		/// \brief	The operation runs entirely on the calling thread.
+		sequential,
+
+		/// \brief	The operation may split its work across the available hardware threads.
+		parallel
+	};
+
 	/// \brief	The file format for a given archive.
 	enum class file_format
 	{
@@ -239,6 +255,33 @@ namespace bsa
 		}
 		return result;
 	}
+
+	/// \brief	Retrieves the default residency hint given to archives mapped from disk.
+	[[nodiscard]] std::size_t residency_hint() noexcept;
+
+	/// \brief	Sets the default residency hint given to archives mapped from disk.
+	/// \details	The hint is the number of bytes of an archive's mapping which the library asks the
+	///		operating system to keep in the process's working set. Once the payloads accessed
+	///		from a mapping exceed it, the least recently used regions are handed back, and are
+	///		transparently paged back in from disk if accessed again. Handing regions back never
+	///		invalidates them, so spans obtained from a payload remain valid even while they are
+	///		being read concurrently, and at worst incur page faults.
+	///		A hint of `0` disables this, and is the default.
+	///
+	/// \param	a_bytes	The hint, in bytes, given to each archive read after it is set.
+	///
+	/// \remark	The hint is captured by each mapping when it is created, so it only applies to
+	///		archives which are read after it is set. Use the `residency_hint` member of
+	///		\ref tes4::archive or \ref fo4::archive to change the hint of an archive which has
+	///		already been read.
+	///
+	/// \warning	This is a hint about residency, not a bound on memory. **Address space is not
+	///		bounded:** archives read from disk are mapped in their entirety, and stay mapped for as
+	///		long as they, or any files read from them, are alive, so large archives may still
+	///		exhaust the address space of 32-bit or otherwise constrained targets. Pages handed
+	///		back may also linger in the operating system's file cache, where they can still count
+	///		against limits such as those of cgroups.
+	void residency_hint(std::size_t a_bytes) noexcept;
 }
 
 #ifndef DOXYGEN
@@ -251,6 +294,8 @@ namespace bsa::detail
                                                                                                      \
 		F(current_executable_directory_failure, "failed to locate the current executable directory") \
 		F(decompress_size_mismatch, "actual decompressed size does not match the expected size")     \
+		F(lz4_block_compress_failure, "failed to compress an lz4 block")                             \
+		F(lz4_block_decompress_failure, "failed to decompress an lz4 block")                         \
                                                                                                      \
 		F(xmem_unavailable, "support for the xmem proxy has not been enabled")                       \
 		F(xmem_version_mismatch, "the xmem proxy does not match the expected version")               \
@@ -318,6 +363,20 @@ namespace bsa::detail
 	[[nodiscard]] auto read_wstring(detail::istream_t& a_in) -> std::string_view;
 	[[nodiscard]] auto read_zstring(detail::istream_t& a_in) -> std::string_view;
 
+	// Invokes the given function once for every index in [0, a_count), spreading the
+	//	work across the available hardware threads when parallel.
+	void for_each_index(
+		std::size_t a_count,
+		const std::function<void(std::size_t)>& a_func,
+		execution_policy a_policy);
+
+	// Splits a table of a_count consecutive null-terminated strings in a single pass.
+	// The returned views point into a_table, and exclude their null terminators.
+	[[nodiscard]] auto split_zstrings(
+		std::span<const std::byte> a_table,
+		std::size_t a_count)
+		-> std::vector<std::string_view>;
+
 	template <class Enum>
 	[[nodiscard]] constexpr auto to_underlying(Enum a_val) noexcept
 		-> std::underlying_type_t<Enum>
@@ -326,17 +385,72 @@ namespace bsa::detail
 		return static_cast<std::underlying_type_t<Enum>>(a_val);
 	}
 
+	[[nodiscard]] constexpr auto align_up(
+		std::size_t a_value,
+		std::size_t a_alignment) noexcept
+		-> std::size_t
+	{
+		if (a_alignment > 1) {
+			return (a_value + a_alignment - 1) / a_alignment * a_alignment;
+		} else {
+			return a_value;
+		}
+	}
+
 	void write_bzstring(detail::ostream_t& a_out, std::string_view a_string) noexcept;
+	void write_padding(detail::ostream_t& a_out, std::size_t a_count) noexcept;
 	void write_wstring(detail::ostream_t& a_out, std::string_view a_string) noexcept;
 	void write_zstring(detail::ostream_t& a_out, std::string_view a_string) noexcept;
 
+	// A read-only mapping of an entire file, which hints how much of it should be kept resident.
+	// Payloads touch the windows they span as they are accessed, and once more windows have
+	//	been touched than the residency hint allows, the least recently used are evicted.
+	// Eviction is advisory: the whole file stays mapped, so address space is never reclaimed,
+	//	and evicted pages are faulted back in from the file, so nothing needs to be pinned while
+	//	a span is being read.
+	class mapped_source final
+	{
+	public:
+		static constexpr std::size_t window_size = std::size_t{ 1 } << 20;
+
+		// a temporary source removes its file once it has been unmapped
+		explicit mapped_source(std::filesystem::path a_path, bool a_temporary = false);
+
+		mapped_source(const mapped_source&) = delete;
+		mapped_source& operator=(const mapped_source&) = delete;
+
+		~mapped_source() noexcept;
+
+		[[nodiscard]] const std::byte* data() const noexcept { return _file.data(); }
+		[[nodiscard]] std::size_t residency_hint() const noexcept { return _hint; }
+		void residency_hint(std::size_t a_bytes) noexcept;
+		[[nodiscard]] std::size_t resident_windows() const noexcept;
+		[[nodiscard]] std::size_t size() const noexcept { return _file.size(); }
+
+		void touch(std::span<const std::byte> a_range) noexcept;
+
+	private:
+		static constexpr auto no_window = (std::numeric_limits<std::size_t>::max)();
+
+		void evict(std::size_t a_window) noexcept;
+		void shrink(std::size_t a_capacity) noexcept;
+
+		mmio::mapped_file_source _file;
+		std::filesystem::path _temporary;
+		std::atomic_size_t _hint{ 0 };
+		std::atomic_size_t _mru{ no_window };  // lets repeated touches of one window skip the lock
+		mutable std::mutex _lock;
+		std::list<std::size_t> _lru;  // most recently used at the front
+		std::unordered_map<std::size_t, std::list<std::size_t>::iterator> _windows;
+	};
+
 	class istream_t final
 	{
 	public:
 		using stream_type = binary_io::span_istream;
-		using file_type = mmio::mapped_file_source;
+		using file_type = mapped_source;
 
-		istream_t(std::filesystem::path a_path);
+		istream_t(std::filesystem::path a_path, bool a_temporary = false);
 		istream_t(std::span<const std::byte> a_bytes, copy_type a_copy) noexcept;
 
 		istream_t(const volatile istream_t&) = delete;
@@ -354,10 +468,17 @@ namespace bsa::detail
 
 		[[nodiscard]] bool deep_copy() const noexcept { return _copy == copy_type::deep; }
 		[[nodiscard]] auto file() const noexcept { return _file; }
+		// an independent cursor over the same source, so that it may be read from another thread
+		[[nodiscard]] auto fork() const noexcept -> istream_t { return { _file, _stream.rdbuf(), _copy }; }
 		[[nodiscard]] bool has_file() const noexcept { return _file != nullptr; }
 		[[nodiscard]] bool shallow_copy() const noexcept { return _copy == copy_type::shallow; }
 
 	private:
+		istream_t(
+			std::shared_ptr<file_type> a_file,
+			std::span<const std::byte> a_bytes,
+			copy_type a_copy) noexcept;
+
 		std::shared_ptr<file_type> _file;
 		stream_type _stream;
 		copy_type _copy{ copy_type::deep };
@@ -386,6 +507,104 @@ namespace bsa::detail
 		istream_t& _proxy;
 		std::size_t _pos;
 	};
+
+	// A map which iterates its elements in the order they were inserted, while still
+	//	supporting lookup by the hash of their key.
+	template <class Key, class T>
+	class ordered_map final
+	{
+	private:
+		using list_type = std::list<std::pair<const Key, T>>;
+
+	public:
+		using key_type = Key;
+		using mapped_type = T;
+		using value_type = typename list_type::value_type;
+		using key_compare = std::less<Key>;
+		using iterator = typename list_type::iterator;
+		using const_iterator = typename list_type::const_iterator;
+
+		ordered_map() noexcept = default;
+		ordered_map(const ordered_map& a_rhs) :
+			_list(a_rhs._list)
+		{
+			this->reindex();
+		}
+		ordered_map(ordered_map&&) noexcept = default;
+
+		~ordered_map() noexcept = default;
+
+		ordered_map& operator=(const ordered_map& a_rhs)
+		{
+			if (this != &a_rhs) {
+				_list = a_rhs._list;
+				this->reindex();
+			}
+			return *this;
+		}
+
+		ordered_map& operator=(ordered_map&&) noexcept = default;
+
+		[[nodiscard]] iterator begin() noexcept { return _list.begin(); }
+		[[nodiscard]] const_iterator begin() const noexcept { return _list.begin(); }
+		[[nodiscard]] const_iterator cbegin() const noexcept { return _list.cbegin(); }
+
+		[[nodiscard]] iterator end() noexcept { return _list.end(); }
+		[[nodiscard]] const_iterator end() const noexcept { return _list.end(); }
+		[[nodiscard]] const_iterator cend() const noexcept { return _list.cend(); }
+
+		[[nodiscard]] bool empty() const noexcept { return _list.empty(); }
+		[[nodiscard]] std::size_t size() const noexcept { return _list.size(); }
+
+		void clear() noexcept
+		{
+			_index.clear();
+			_list.clear();
+		}
+
+		template <class K, class V>
+		std::pair<iterator, bool> emplace(K&& a_key, V&& a_value)
+		{
+			const auto it = _index.find(a_key.hash());
+			if (it != _index.end()) {
+				return { it->second, false };
+			}
+
+			const auto pos = _list.emplace(_list.end(), std::forward<K>(a_key), std::forward<V>(a_value));
+			_index.emplace(pos->first.hash(), pos);
+			return { pos, true };
+		}
+
+		void erase(const_iterator a_pos) noexcept
+		{
+			_index.erase(a_pos->first.hash());
+			_list.erase(a_pos);
+		}
+
+		[[nodiscard]] iterator find(const key_type& a_key) noexcept
+		{
+			const auto it = _index.find(a_key.hash());
+			return it != _index.end() ? it->second : _list.end();
+		}
+
+		[[nodiscard]] const_iterator find(const key_type& a_key) const noexcept
+		{
+			const auto it = _index.find(a_key.hash());
+			return it != _index.end() ? const_iterator{ it->second } : _list.end();
+		}
+
+	private:
+		void reindex()
+		{
+			_index.clear();
+			for (auto it = _list.begin(); it != _list.end(); ++it) {
+				_index.emplace(it->first.hash(), it);
+			}
+		}
+
+		list_type _list;
+		std::map<typename Key::hash_type, iterator> _index;
+	};
 }
 #endif
 
@@ -484,6 +703,103 @@ namespace bsa
 	};
 }
 
+namespace bsa
+{
+	/// \brief	A reusable buffer for extracting data out of an archive.
+	/// \details	Decompressing a file into a freshly allocated `std::vector` pays for an
+	///		allocation, and the zero-filling of its pages, on every extraction. A scratch buffer
+	///		instead grows to fit the largest payload it has been asked to hold, and is then reused
+	///		as-is, so that bulk extraction amortizes to no allocations at all.
+	class scratch_buffer final
+	{
+	public:
+		/// \name Assignment
+		/// @{
+
+		scratch_buffer& operator=(const scratch_buffer&) = delete;
+		scratch_buffer& operator=(scratch_buffer&&) noexcept = default;
+
+		/// @}
+
+		/// \name Capacity
+		/// @{
+
+		/// \brief	Returns the number of bytes the buffer can hold without reallocating.
+		[[nodiscard]] std::size_t capacity() const noexcept { return _capacity; }
+
+		/// \brief	Reserves storage for at least `a_capacity` bytes.
+		/// \remark	Any views previously obtained from the buffer are invalidated if the buffer grows.
+		void reserve(std::size_t a_capacity)
+		{
+			if (a_capacity > _capacity) {
+				_data = std::make_unique_for_overwrite<std::byte[]>(a_capacity);
+				_capacity = a_capacity;
+			}
+		}
+
+		/// @}
+
+		/// \name Constructors
+		/// @{
+
+		scratch_buffer() noexcept = default;
+		scratch_buffer(const scratch_buffer&) = delete;
+		scratch_buffer(scratch_buffer&&) noexcept = default;
+
+		/// \brief	Constructs a buffer with storage for at least `a_capacity` bytes.
+		explicit scratch_buffer(std::size_t a_capacity) { this->reserve(a_capacity); }
+
+		/// @}
+
+		/// \name Destructor
+		/// @{
+
+		~scratch_buffer() noexcept = default;
+
+		/// @}
+
+		/// \name Element access
+		/// @{
+
+		/// \brief	Obtains a writable view of exactly `a_size` bytes, growing the buffer as needed.
+		/// \remark	The contents of the view are unspecified.
+		/// \remark	Any views previously obtained from the buffer are invalidated.
+		[[nodiscard]] std::span<std::byte> acquire(std::size_t a_size)
+		{
+			this->reserve(a_size);
+			return { _data.get(), a_size };
+		}
+
+		/// @}
+
+		/// \name Modifiers
+		/// @{
+
+		/// \brief	Releases the storage held by the buffer.
+		void clear() noexcept
+		{
+			_data.reset();
+			_capacity = 0;
+		}
+
+		/// @}
+
+	private:
+		std::unique_ptr<std::byte[]> _data;
+		std::size_t _capacity{ 0 };
+	};
+
+	/// \brief	Describes the size of an archive, as it would be written.
+	struct size_info final
+	{
+		/// \brief	The total size of the archive, in bytes.
+		std::size_t size{ 0 };
+
+		/// \brief	The number of bytes spent on padding payloads to their alignment.
+		std::size_t padding{ 0 };
+	};
+}
+
 namespace bsa::concepts
 {
 #ifdef DOXYGEN
@@ -711,12 +1027,16 @@ namespace bsa::components
 	///
 	/// \tparam	T	The `mapped_type`.
 	/// \tparam	RECURSE	Determines if indexing via `operator[]` is a recursive action.
-	template <class T, bool RECURSE>
+	/// \tparam	ORDERED	Determines if the container iterates in insertion order, rather than
+	///		in the order of its keys.
+	template <class T, bool RECURSE, bool ORDERED>
 	class hashmap
 	{
 	private:
-		using container_type =
-			std::map<typename T::key, T>;
+		using container_type = std::conditional_t<
+			ORDERED,
+			detail::ordered_map<typename T::key, T>,
+			std::map<typename T::key, T>>;
 
 	public:
 		/// \name Member types
@@ -1093,4 +1413,190 @@ namespace bsa::components
 
 		static_assert(name_count == std::variant_size_v<decltype(_name)>);
 	};
+
+	/// \brief	Accepts insertions from many threads at once, and finalizes them into a
+	///		regular archive.
+	/// \details	Keys are distributed across independently locked shards by their hash, so
+	///		threads which insert different keys rarely contend with one another. For archives
+	///		which index files by directory, a file is sharded by both its directory and its
+	///		own name, so even a single large directory can be populated concurrently.
+	///
+	/// \tparam	Archive	The archive type to build.
+	template <class Archive>
+	class sharded_builder final
+	{
+	private:
+		static constexpr bool RECURSIVE = requires { typename Archive::mapped_type::key_type; };
+
+	public:
+		/// \name Member types
+		/// @{
+
+		using archive_type = Archive;
+		using key_type = typename Archive::key_type;
+		using mapped_type = typename Archive::mapped_type;
+
+		/// @}
+
+		/// \name Constructors
+		/// @{
+
+		/// \brief	Constructs an empty builder.
+		///
+		/// \param	a_shards	The number of shards to distribute keys across.
+		explicit sharded_builder(std::size_t a_shards = 64) :
+			_shards((std::max)(a_shards, std::size_t{ 1 }))
+		{}
+
+		sharded_builder(const sharded_builder&) = delete;
+
+		/// @}
+
+		/// \name Assignment
+		/// @{
+
+		sharded_builder& operator=(const sharded_builder&) = delete;
+
+		/// @}
+
+		/// \name Modifiers
+		/// @{
+
+		/// \brief	Inserts `a_value` with the given `a_key`.
+		/// \remark	This function is safe to call concurrently.
+		///
+		/// \param	a_key	The key of the value.
+		/// \param	a_value	The value to insert.
+		/// \return	Returns `true` if the insertion was successful, or `false` if the key
+		///		had already been inserted.
+		bool insert(
+			key_type a_key,
+			mapped_type a_value)  //
+			requires(!RECURSIVE)
+		{
+			auto& shard = this->shard_for(a_key.hash());
+			const std::scoped_lock l{ shard.lock };
+			return shard.map.emplace(std::move(a_key), std::move(a_value)).second;
+		}
+
+		/// \brief	Inserts `a_value` with the given `a_key` into the directory with the given
+		///		`a_directory`, creating it if it doesn't exist.
+		/// \remark	This function is safe to call concurrently.
+		///
+		/// \param	a_directory	The key of the directory.
+		/// \param	a_key	The key of the value within the directory.
+		/// \param	a_value	The value to insert.
+		/// \return	Returns `true` if the insertion was successful, or `false` if the key
+		///		had already been inserted into the directory.
+		template <class Directory = mapped_type>
+		bool insert(
+			key_type a_directory,
+			typename Directory::key_type a_key,
+			typename Directory::mapped_type a_value)  //
+			requires(RECURSIVE)
+		{
+			auto& shard = this->shard_for(a_directory.hash(), a_key.hash());
+			const std::scoped_lock l{ shard.lock };
+			auto it = shard.map.find(a_directory);
+			if (it == shard.map.end()) {
+				it = shard.map.emplace(std::move(a_directory), mapped_type{}).first;
+			}
+			return it->second.insert(std::move(a_key), std::move(a_value)).second;
+		}
+
+		/// \brief	Moves everything inserted so far into a new archive, leaving the builder empty.
+		/// \details	Entries are inserted into the archive in key order, so the result doesn't
+		///		depend on the number of shards, nor on the order in which threads inserted them.
+		/// \remark	This function is *not* safe to call concurrently with \ref insert.
+		///
+		/// \param	a_policy	The execution policy to merge with. The portions of a directory
+		///		which were populated in different shards are merged concurrently when parallel.
+		/// \return	The finalized archive.
+		[[nodiscard]] auto finalize(execution_policy a_policy = execution_policy::parallel)
+			-> archive_type
+		{
+			archive_type result;
+			std::vector<std::pair<key_type, mapped_type>> entries;
+			for (auto& shard : _shards) {
+				while (!shard.map.empty()) {
+					auto node = shard.map.extract(shard.map.begin());
+					entries.emplace_back(std::move(node.key()), std::move(node.mapped()));
+				}
+			}
+
+			// shards are visited in hash order, so restore key order before anything is inserted.
+			// a directory may also be split across several shards, which gathers its portions together
+			std::stable_sort(
+				entries.begin(),
+				entries.end(),
+				[](const auto& a_lhs, const auto& a_rhs) noexcept {
+					return a_lhs.first < a_rhs.first;
+				});
+
+			if constexpr (RECURSIVE) {
+				std::vector<std::size_t> groups;
+				for (std::size_t i = 0; i < entries.size(); ++i) {
+					if (i == 0 || entries[i - 1].first != entries[i].first) {
+						groups.push_back(i);
+					}
+				}
+
+				detail::for_each_index(
+					groups.size(),
+					[&](std::size_t a_idx) {
+						const auto first = groups[a_idx];
+						const auto last = a_idx + 1 < groups.size() ? groups[a_idx + 1] : entries.size();
+						auto& directory = entries[first].second;
+						for (auto i = first + 1; i < last; ++i) {
+							for (auto& [key, value] : entries[i].second) {
+								[[maybe_unused]] const auto [it, success] =
+									directory.insert(key, std::move(value));
+								assert(success);
+							}
+						}
+					},
+					a_policy);
+
+				for (const auto group : groups) {
+					result.insert(
+						std::move(entries[group].first),
+						std::move(entries[group].second));
+				}
+			} else {
+				for (auto& [key, value] : entries) {
+					result.insert(std::move(key), std::move(value));
+				}
+			}
+
+			return result;
+		}
+
+		/// @}
+
+	private:
+		struct shard_t final
+		{
+			std::mutex lock;
+			std::map<key_type, mapped_type> map;
+		};
+
+		template <class... Hashes>
+		[[nodiscard]] auto shard_for(const Hashes&... a_hashes) noexcept
+			-> shard_t&
+		{
+			// fnv-1a
+			std::uint64_t result = 0xCBF29CE484222325;
+			const auto fold = [&]<class Hash>(const Hash& a_hash) noexcept {
+				static_assert(std::has_unique_object_representations_v<Hash>);
+				for (const auto byte : std::as_bytes(std::span{ &a_hash, 1 })) {
+					result ^= static_cast<std::uint64_t>(byte);
+					result *= 0x100000001B3;
+				}
+			};
+			(fold(a_hashes), ...);
+			return _shards[result % _shards.size()];
+		}
+
+		std::vector<shard_t> _shards;
+	};
 }
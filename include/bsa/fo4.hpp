@@ -5,6 +5,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <span>
 #include <string>
@@ -49,6 +50,30 @@ namespace bsa::fo4
 		xbox
 	};
 
+	/// \brief	Archive versions.
+	enum class version : std::uint32_t
+	{
+		/// \brief	The original revision of the format, used by Fallout 4.
+		v1 = 1,
+
+		/// \brief	Extends the header with an additional, unused field.
+		v2 = 2,
+
+		/// \brief	Extends the header further with the \ref compression_format "format"
+		///		every chunk is compressed with.
+		v3 = 3,
+	};
+
+	/// \brief	Specifies the codec chunks are compressed with.
+	enum class compression_format : std::uint32_t
+	{
+		/// \brief	Chunks are compressed as zlib streams.
+		zip = 0,
+
+		/// \brief	Chunks are compressed as lz4 blocks. Only supported by \ref version::v3.
+		lz4 = 3,
+	};
+
 	namespace hashing
 	{
 		struct hash final
@@ -105,8 +130,18 @@ namespace bsa::fo4
 		friend file;
 		using super = components::compressed_byte_container;
 
-		[[nodiscard]] std::size_t compress_into_default(std::span<std::byte> a_out) const;
-		[[nodiscard]] std::size_t compress_into_xbox(std::span<std::byte> a_out) const;
+		[[nodiscard]] std::size_t compress_into_default(
+			std::span<std::byte> a_out,
+			execution_policy a_policy) const;
+		[[nodiscard]] std::size_t compress_into_xbox(
+			std::span<std::byte> a_out,
+			execution_policy a_policy) const;
+		[[nodiscard]] std::size_t compress_into_lz4(
+			std::span<std::byte> a_out,
+			compression_level a_level) const;
+
+		void decompress_into_lz4(std::span<std::byte> a_out) const;
+		void decompress_into_zip(std::span<std::byte> a_out) const;
 
 	public:
 		/// \brief	Unique to \ref format::directx.
@@ -141,18 +176,49 @@ namespace bsa::fo4
 		/// \copydoc bsa::doxygen_detail::compress
 		///
 		/// \param	a_level	The level to compress the data at.
+		/// \param	a_policy	The execution policy to compress with. Large chunks may be split
+		///		into blocks which are deflated in parallel, yet still form a single zlib stream.
+		void compress(
+			compression_level a_level = compression_level::normal,
+			execution_policy a_policy = execution_policy::sequential);
+
+		/// \copydoc bsa::doxygen_detail::compress
+		///
+		/// \param	a_compressionFormat	The format to compress the data with.
+		/// \param	a_level	The level to compress the data at. Lz4 blocks are compressed with
+		///		the high compression codec at \ref compression_level::xbox.
+		/// \param	a_policy	The execution policy to compress with. Only zlib streams may be
+		///		deflated in parallel.
 		void compress(
-			compression_level a_level = compression_level::normal);
+			compression_format a_compressionFormat,
+			compression_level a_level = compression_level::normal,
+			execution_policy a_policy = execution_policy::sequential);
 
 		/// \copydoc bsa::doxygen_detail::compress_bound
-		[[nodiscard]] std::size_t compress_bound() const;
+		///
+		/// \param	a_compressionFormat	The format the data would be compressed with.
+		[[nodiscard]] std::size_t compress_bound(
+			compression_format a_compressionFormat = compression_format::zip) const;
+
+		/// \copydoc bsa::doxygen_detail::compress_into
+		///
+		/// \param	a_level	The level to compress the data at.
+		/// \param	a_policy	The execution policy to compress with.
+		[[nodiscard]] std::size_t compress_into(
+			std::span<std::byte> a_out,
+			compression_level a_level = compression_level::normal,
+			execution_policy a_policy = execution_policy::sequential) const;
 
 		/// \copydoc bsa::doxygen_detail::compress_into
 		///
+		/// \param	a_compressionFormat	The format to compress the data with.
 		/// \param	a_level	The level to compress the data at.
+		/// \param	a_policy	The execution policy to compress with.
 		[[nodiscard]] std::size_t compress_into(
 			std::span<std::byte> a_out,
-			compression_level a_level = compression_level::normal) const;
+			compression_format a_compressionFormat,
+			compression_level a_level = compression_level::normal,
+			execution_policy a_policy = execution_policy::sequential) const;
 
 		/// @}
 
@@ -167,8 +233,10 @@ namespace bsa::fo4
 		/// \exception	bsa::compression_error	Thrown when any backend compression library errors
 		///		are encountered.
 		///
+		/// \param	a_compressionFormat	The format the data was compressed with.
+		///
 		/// \remark	If a compression error is thrown, then the contents are left unchanged.
-		void decompress();
+		void decompress(compression_format a_compressionFormat = compression_format::zip);
 
 		/// \brief	Decompresses the file into the given buffer.
 		///
@@ -180,10 +248,27 @@ namespace bsa::fo4
 		///		are encountered.
 		///
 		/// \param	a_out	The buffer to decompress the file into.
+		/// \param	a_compressionFormat	The format the data was compressed with.
 		///
 		/// \remark	If a compression error is thrown, then the contents of `a_out` are left
 		///		in an unspecified state.
-		void decompress_into(std::span<std::byte> a_out) const;
+		void decompress_into(
+			std::span<std::byte> a_out,
+			compression_format a_compressionFormat = compression_format::zip) const;
+
+		/// \copybrief bsa::tes4::file::extract
+		/// \copydetails bsa::tes4::file::extract
+		///
+		/// \exception	bsa::compression_error	Thrown when any backend compression library errors
+		///		are encountered.
+		///
+		/// \param	a_buffer	The buffer to decompress the chunk into, if required.
+		/// \param	a_compressionFormat	The format the chunk was compressed with.
+		/// \return	A view of the decompressed contents of the chunk, which remains valid until
+		///		`a_buffer` is next used, or the chunk is modified.
+		[[nodiscard]] std::span<const std::byte> extract(
+			scratch_buffer& a_buffer,
+			compression_format a_compressionFormat = compression_format::zip) const;
 
 		/// @}
 
@@ -200,6 +285,28 @@ namespace bsa::fo4
 		/// @}
 	};
 
+	/// \brief	Controls how the mips of a \ref format::directx "texture" are split into chunks.
+	/// \details	Consecutive mips are packed into a chunk until the next mip would bring it to
+	///		\ref size bytes or more. Mips are never split, so a single mip which exceeds the budget
+	///		still occupies a chunk of its own. Cubemaps are never chunked.
+	struct chunk_budget final
+	{
+		/// \brief	The number of bytes a chunk should stay beneath.
+		/// \details	When zero, the budget is derived from the format of each texture, as the size
+		///		of a single mip with the given \ref width and \ref height.
+		std::size_t size{ 0 };
+
+		/// \brief	The width of the mip the budget is derived from, when \ref size is zero.
+		std::size_t width{ 512 };
+
+		/// \brief	The height of the mip the budget is derived from, when \ref size is zero.
+		std::size_t height{ 512 };
+
+		/// \brief	The most chunks a texture may be split into. Any mips left over once the
+		///		limit is reached are appended to the last chunk.
+		std::size_t count{ 4 };
+	};
+
 	/// \brief	Represents a file within the FO4 virtual filesystem.
 	class file final
 	{
@@ -384,7 +491,8 @@ namespace bsa::fo4
 			std::size_t a_mipChunkWidth = 512u,
 			std::size_t a_mipChunkHeight = 512u,
 			compression_level a_level = compression_level::normal,
-			compression_type a_compression = compression_type::decompressed);
+			compression_type a_compression = compression_type::decompressed,
+			compression_format a_compressionFormat = compression_format::zip);
 
 		/// \copydoc bsa::tes3::file::read(std::span<const std::byte>, copy_type)
 		/// \copydoc bsa::fo4::file::doxygen_read
@@ -395,7 +503,29 @@ namespace bsa::fo4
 			std::size_t a_mipChunkHeight = 512u,
 			compression_level a_level = compression_level::normal,
 			compression_type a_compression = compression_type::decompressed,
-			copy_type a_copy = copy_type::deep);
+			copy_type a_copy = copy_type::deep,
+			compression_format a_compressionFormat = compression_format::zip);
+
+		/// \copydoc bsa::tes3::file::read(std::filesystem::path)
+		/// \copydoc bsa::fo4::file::doxygen_read_budget
+		void read(
+			std::filesystem::path a_path,
+			format a_format,
+			const chunk_budget& a_budget,
+			compression_level a_level = compression_level::normal,
+			compression_type a_compression = compression_type::decompressed,
+			compression_format a_compressionFormat = compression_format::zip);
+
+		/// \copydoc bsa::tes3::file::read(std::span<const std::byte>, copy_type)
+		/// \copydoc bsa::fo4::file::doxygen_read_budget
+		void read(
+			std::span<const std::byte> a_src,
+			format a_format,
+			const chunk_budget& a_budget,
+			compression_level a_level = compression_level::normal,
+			compression_type a_compression = compression_type::decompressed,
+			copy_type a_copy = copy_type::deep,
+			compression_format a_compressionFormat = compression_format::zip);
 
 		/// @}
 
@@ -406,13 +536,31 @@ namespace bsa::fo4
 		/// \copydoc bsa::fo4::file::doxygen_write
 		void write(
 			std::filesystem::path a_path,
-			format a_format) const;
+			format a_format,
+			compression_format a_compressionFormat = compression_format::zip) const;
 
 		/// \copydoc bsa::tes3::file::write(binary_io::any_ostream&) const
 		/// \copydoc bsa::fo4::file::doxygen_write
 		void write(
 			binary_io::any_ostream& a_dst,
-			format a_format) const;
+			format a_format,
+			compression_format a_compressionFormat = compression_format::zip) const;
+
+		/// \brief	Writes the mips `a_first` through the last mip of the file to disk, as a
+		///		standalone \ref format::directx "dds" file.
+		/// \copydoc bsa::fo4::file::doxygen_write_mips
+		void write_mips(
+			std::filesystem::path a_path,
+			std::size_t a_first,
+			compression_format a_compressionFormat = compression_format::zip) const;
+
+		/// \brief	Writes the mips `a_first` through the last mip of the file to the given
+		///		stream, as a standalone \ref format::directx "dds" file.
+		/// \copydoc bsa::fo4::file::doxygen_write_mips
+		void write_mips(
+			binary_io::any_ostream& a_dst,
+			std::size_t a_first,
+			compression_format a_compressionFormat = compression_format::zip) const;
 
 		/// @}
 
@@ -426,15 +574,41 @@ namespace bsa::fo4
 		/// \param	a_mipChunkHeight	The maxiumum height to restrict a single mip chunk to.
 		/// \param	a_level	The level to compress the data at.
 		/// \param	a_compression	The resulting compression of the file read.
+		/// \param	a_compressionFormat	The format to compress the chunks with, which *must* match
+		///		the \ref archive::archive_compression "compression" of the archive they're written to.
 		void doxygen_read(
 			format a_format,
 			std::size_t a_mipChunkWidth = 512u,
 			std::size_t a_mipChunkHeight = 512u,
 			compression_level a_level = compression_level::normal,
-			compression_type a_compression = compression_type::decompressed);
+			compression_type a_compression = compression_type::decompressed,
+			compression_format a_compressionFormat = compression_format::zip);
+
+		/// \param	a_format	The format to read the file as.
+		/// \param	a_budget	Controls how the mips of a texture are split into chunks.
+		/// \param	a_level	The level to compress the data at.
+		/// \param	a_compression	The resulting compression of the file read.
+		/// \param	a_compressionFormat	The format to compress the chunks with, which *must* match
+		///		the \ref archive::archive_compression "compression" of the archive they're written to.
+		void doxygen_read_budget(
+			format a_format,
+			const chunk_budget& a_budget,
+			compression_level a_level = compression_level::normal,
+			compression_type a_compression = compression_type::decompressed,
+			compression_format a_compressionFormat = compression_format::zip);
 
 		/// \param	a_format	The format to write the file as.
-		void doxygen_write(format a_format) const;
+		/// \param	a_compressionFormat	The format the chunks of the file are compressed with.
+		void doxygen_write(format a_format, compression_format a_compressionFormat) const;
+
+		/// \details	Only the chunks which cover the requested mips are decompressed.
+		///
+		/// \exception	bsa::exception	Thrown when `a_first` is not less than the mip count
+		///		of the file.
+		///
+		/// \param	a_first	The index of the first mip to write.
+		/// \param	a_compressionFormat	The format the chunks of the file are compressed with.
+		void doxygen_write_mips(std::size_t a_first, compression_format a_compressionFormat) const;
 
 		/// @}
 #endif
@@ -443,48 +617,178 @@ namespace bsa::fo4
 		void do_read(
 			detail::istream_t& a_in,
 			format a_format,
-			std::size_t a_mipChunkWidth,
-			std::size_t a_mipChunkHeight,
+			const chunk_budget& a_budget,
 			compression_level a_level,
-			compression_type a_compression);
+			compression_type a_compression,
+			compression_format a_compressionFormat);
 		void do_write(
 			detail::ostream_t& a_out,
-			format a_format) const;
+			format a_format,
+			compression_format a_compressionFormat) const;
 
 		void read_directx(
 			detail::istream_t& a_in,
-			std::size_t a_mipChunkWidth,
-			std::size_t a_mipChunkHeight,
+			const chunk_budget& a_budget,
 			compression_level a_level,
-			compression_type a_compression);
+			compression_type a_compression,
+			compression_format a_compressionFormat);
 		void read_general(
 			detail::istream_t& a_in,
 			compression_level a_level,
-			compression_type a_compression);
+			compression_type a_compression,
+			compression_format a_compressionFormat);
 
-		void write_directx(detail::ostream_t& a_out) const;
-		void write_general(detail::ostream_t& a_out) const;
+		void write_directx(
+			detail::ostream_t& a_out,
+			compression_format a_compressionFormat) const;
+		void write_directx_mips(
+			detail::ostream_t& a_out,
+			std::size_t a_first,
+			compression_format a_compressionFormat) const;
+		void write_general(
+			detail::ostream_t& a_out,
+			compression_format a_compressionFormat) const;
 
 		container_type _chunks;
 	};
 
+	/// \brief	Reads a batch of files from disk, spreading the work across a pool of worker
+	///		threads.
+	/// \details	Each file is read exactly as \ref file::read would read it: textures are parsed,
+	///		split into their mip chunks, and, if requested, each chunk is compressed. The files
+	///		produced are ready to be inserted into an \ref archive.
+	///
+	///		The workers are drawn from a pool which is shared by the whole library, started on first
+	///		use, and sized to the hardware, so repeated calls reuse the same threads, and no more
+	///		than one file per hardware thread is in flight at once.
+	///
+	/// \exception	std::system_error	Thrown when any file fails to open.
+	/// \exception	bsa::exception	Thrown when any file is malformed.
+	/// \exception	bsa::compression_error	Thrown when any backend compression library errors
+	///		are encountered.
+	///
+	/// \param	a_paths	The paths of the files to read.
+	/// \copydoc bsa::fo4::file::doxygen_read
+	/// \param	a_policy	The execution policy to read with. Files are read concurrently
+	///		when parallel.
+	///
+	/// \return	The files read, in the same order as `a_paths`. The result is identical
+	///		regardless of the number of threads used.
+	///
+	/// \remark	If an exception is thrown, it is unspecified which file it originated from
+	///		when reading in parallel.
+	/// \remark	Just as with \ref file::read, chunks which are left decompressed keep referring
+	///		to a mapping of their source file, so every such source stays mapped for as long as
+	///		the files returned do.
+	[[nodiscard]] auto read_files(
+		std::span<const std::filesystem::path> a_paths,
+		format a_format,
+		std::size_t a_mipChunkWidth = 512u,
+		std::size_t a_mipChunkHeight = 512u,
+		compression_level a_level = compression_level::normal,
+		compression_type a_compression = compression_type::decompressed,
+		execution_policy a_policy = execution_policy::parallel,
+		compression_format a_compressionFormat = compression_format::zip)
+		-> std::vector<file>;
+
+	/// \copybrief bsa::fo4::read_files
+	/// \copydetails bsa::fo4::read_files
+	///
+	/// \param	a_paths	The paths of the files to read.
+	/// \copydoc bsa::fo4::file::doxygen_read_budget
+	/// \param	a_policy	The execution policy to read with. Files are read concurrently
+	///		when parallel.
+	[[nodiscard]] auto read_files(
+		std::span<const std::filesystem::path> a_paths,
+		format a_format,
+		const chunk_budget& a_budget,
+		compression_level a_level = compression_level::normal,
+		compression_type a_compression = compression_type::decompressed,
+		execution_policy a_policy = execution_policy::parallel,
+		compression_format a_compressionFormat = compression_format::zip)
+		-> std::vector<file>;
+
+	/// \brief	Options which control how an \ref archive is written.
+	struct write_options final
+	{
+		/// \copydoc bsa::tes4::write_options::alignment
+		std::size_t alignment{ 0 };
+
+		/// \copydoc bsa::tes4::write_options::alignment_threshold
+		std::size_t alignment_threshold{ 0 };
+
+		/// \copydoc bsa::tes4::write_options::payload_order
+		std::span<const std::string> payload_order{};
+	};
+
 	/// \brief	Represents the FO4 revision of the ba2 format.
+	/// \details	Unlike the bsa formats, files are not sorted by their hash. The archive is
+	///		iterated, and written, in the order its files were inserted, and reading an archive
+	///		inserts its files in the order of their records on disk.
 	class archive final :
-		public components::hashmap<file>
+		public components::hashmap<file, false, true>
 	{
 	private:
-		using super = components::hashmap<file>;
+		using super = components::hashmap<file, false, true>;
 
 	public:
+		/// \name Archive info
+		/// @{
+
+		/// \brief	Retrieves the version the archive is written as.
+		[[nodiscard]] version archive_version() const noexcept { return _version; }
+		/// \brief	Sets the version the archive is written as.
+		void archive_version(version a_version) noexcept { _version = a_version; }
+
+		/// \brief	Retrieves the format the chunks of the archive are compressed with.
+		[[nodiscard]] compression_format archive_compression() const noexcept { return _compression; }
+		/// \brief	Sets the format the chunks of the archive are compressed with.
+		/// \remark	Chunks are not recompressed. Any compressed chunks *must* already have been
+		///		compressed with the given format.
+		void archive_compression(compression_format a_compression) noexcept { _compression = a_compression; }
+
+		/// @}
+
 		/// \name Modifiers
 		/// @{
 
-#ifdef DOXYGEN
-		/// \brief	Clears the contents of the archive.
-		void clear() noexcept;
-#else
-		using super::clear;
-#endif
+		/// \brief	Clears the contents, version, and compression format of the archive.
+		void clear() noexcept
+		{
+			super::clear();
+			_version = version::v1;
+			_compression = compression_format::zip;
+			_source.reset();
+		}
+
+		/// \copydoc bsa::tes4::archive::merge
+		/// \details	If the archives' \ref archive_compression "compression formats" differ, the
+		///		compressed chunks merged from `a_other` are recompressed for this archive's format.
+		/// \pre	Both archives *must* be written in the same \ref format.
+		///
+		/// \exception	bsa::compression_error	Thrown when chunks fail to be recompressed.
+		std::size_t merge(
+			const archive& a_other,
+			bool a_replace = false);
+
+		/// @}
+
+		/// \name Residency
+		/// @{
+
+		/// \copydoc bsa::tes4::archive::residency_hint() const
+		[[nodiscard]] std::size_t residency_hint() const noexcept
+		{
+			return _source ? _source->residency_hint() : 0;
+		}
+
+		/// \copydoc bsa::tes4::archive::residency_hint(std::size_t)
+		void residency_hint(std::size_t a_bytes) noexcept
+		{
+			if (_source) {
+				_source->residency_hint(a_bytes);
+			}
+		}
 
 		/// @}
 
@@ -506,19 +810,61 @@ namespace bsa::fo4
 		/// \name Writing
 		/// @{
 
+		/// \copybrief bsa::tes4::archive::measure
+		/// \copydetails bsa::tes4::archive::measure
+		///
+		/// \param	a_format	The format to measure.
+		/// \param	a_strings	Controls whether the string table is measured or not.
+		/// \param	a_options	The options to measure with.
+		/// \return	The size of the archive, and the padding within it.
+		[[nodiscard]] auto measure(
+			format a_format,
+			bool a_strings = true,
+			const write_options& a_options = {}) const
+			-> size_info;
+
 		/// \copydoc bsa::tes3::archive::write(std::filesystem::path) const
 		/// \copydoc bsa::fo4::archive::doxygen_write
 		void write(
 			std::filesystem::path a_path,
 			format a_format,
-			bool a_strings = true) const;
+			bool a_strings = true,
+			const write_options& a_options = {}) const;
 
 		/// \copydoc bsa::tes3::archive::write(binary_io::any_ostream&) const
 		/// \copydoc bsa::fo4::archive::doxygen_write
 		void write(
 			binary_io::any_ostream& a_dst,
 			format a_format,
-			bool a_strings = true) const;
+			bool a_strings = true,
+			const write_options& a_options = {}) const;
+
+		/// \brief	Writes the archive back to the file it was read from, without rewriting
+		///		the chunks which are already there.
+		/// \details	Works like \ref bsa::tes4::archive::update. Chunks which are still mapped from
+		///		`a_path` are left in place, new or changed chunks are appended, and the string table
+		///		is rewritten after them. The same mapping release, preconditions, and lack of crash-safety
+		///		when updating in place apply.
+		/// \pre	If the archive was read from disk, it *must* have been read from `a_path`.
+		///
+		/// \warning	Updating in place is neither atomic nor crash-safe. Pass a negative `a_threshold`
+		///		to always compact into a temporary file which atomically replaces `a_path` instead.
+		///
+		/// \exception	bsa::exception	Thrown when the file fails to be updated.
+		/// \exception	std::system_error	Thrown when filesystem errors are encountered.
+		///
+		/// \param	a_path	The path of the archive to update.
+		/// \param	a_format	The format to write the archive in.
+		/// \param	a_strings	Controls whether the string table is written or not.
+		/// \param	a_threshold	The largest fraction of the file which may be left as dead space
+		///		before the archive is compacted.
+		/// \param	a_options	The options to write with.
+		void update(
+			std::filesystem::path a_path,
+			format a_format,
+			bool a_strings = true,
+			double a_threshold = 0.25,
+			const write_options& a_options = {});
 
 		/// @}
 
@@ -527,12 +873,22 @@ namespace bsa::fo4
 		/// \name Doxygen only
 		/// @{
 
+		/// \details	The \ref archive_version() "version" and
+		///		\ref archive_compression() "compression format" of the archive are read from its header.
+		///
 		/// \return	The format of the archive that was read.
 		format doxygen_read();
 
+		/// \details	The archive is written as its current \ref archive_version() "version".
+		///
+		/// \exception	bsa::exception	Thrown when the \ref archive_compression() "compression format"
+		///		can not be represented by the \ref archive_version() "version", or when a compressed
+		///		chunk is not framed as that format. Chunks are only checked structurally, not decoded.
+		///
 		/// \param	a_format	The format to write the archive in.
 		/// \param	a_strings	Controls whether the string table is written or not.
-		void doxygen_write(format a_format, bool a_strings) const;
+		/// \param	a_options	The options to write with.
+		void doxygen_write(format a_format, bool a_strings, const write_options& a_options) const;
 
 		/// @}
 #endif
@@ -543,12 +899,16 @@ namespace bsa::fo4
 		void do_write(
 			detail::ostream_t& a_out,
 			format a_format,
-			bool a_strings) const;
+			bool a_strings,
+			const write_options& a_options) const;
 
-		[[nodiscard]] auto make_header(
+		[[nodiscard]] auto layout_chunk_data(
 			format a_format,
-			bool a_strings) const noexcept
-			-> std::pair<detail::header_t, std::uint64_t>;
+			const write_options& a_options) const
+			-> std::pair<std::vector<std::uint64_t>, size_info>;
+
+		[[nodiscard]] auto offsetof_chunk_data(format a_format) const noexcept
+			-> std::uint64_t;
 
 		void read_chunk(
 			chunk& a_chunk,
@@ -564,12 +924,24 @@ namespace bsa::fo4
 			const chunk& a_chunk,
 			detail::ostream_t& a_out,
 			format a_format,
-			std::uint64_t& a_dataOffset) const noexcept;
+			std::uint64_t a_dataOffset) const noexcept;
 
 		void write_file(
 			const file& a_file,
 			detail::ostream_t& a_out,
 			format a_format,
-			std::uint64_t& a_dataOffset) const noexcept;
+			std::span<const std::uint64_t> a_offsets) const noexcept;
+
+		void write_index(
+			detail::ostream_t& a_out,
+			format a_format,
+			std::span<const std::uint64_t> a_offsets) const noexcept;
+
+		std::shared_ptr<detail::istream_t::file_type> _source;
+		version _version{ version::v1 };
+		compression_format _compression{ compression_format::zip };
 	};
+
+	/// \brief	Builds an \ref archive from many threads at once.
+	using archive_builder = components::sharded_builder<archive>;
 }
@@ -21,7 +21,7 @@ namespace bsa
 		class byte_container;
 		class compressed_byte_container;
 
-		template <class, bool = false>
+		template <class, bool = false, bool = false>
 		class hashmap;
 
 		template <class Hash>
@@ -29,6 +29,9 @@ namespace bsa
 
 		template <class Hash, hasher_t<Hash>>
 		class key;
+
+		template <class>
+		class sharded_builder;
 	}
 
 	namespace fo4
@@ -45,11 +48,16 @@ namespace bsa
 			struct hash;
 		}
 
+		enum class compression_format : std::uint32_t;
 		enum class format : std::uint32_t;
+		enum class version : std::uint32_t;
 
 		class archive;
 		class chunk;
 		class file;
+
+		struct chunk_budget;
+		struct write_options;
 	}
 
 	namespace tes3
@@ -88,14 +96,20 @@ namespace bsa
 		class directory;
 		class file;
 
+		struct write_options;
+
 		enum class archive_flag : std::uint32_t;
 		enum class archive_type : std::uint16_t;
 		enum class version : std::uint32_t;
 	}
 
 	class exception;
+	class scratch_buffer;
+
+	struct size_info;
 
 	enum class copy_type;
 	enum class compression_type;
+	enum class execution_policy;
 	enum class file_format;
 }
@@ -273,4 +273,7 @@ namespace bsa::tes3
 		void write_file_hashes(detail::ostream_t& a_out) const noexcept;
 		void write_file_data(detail::ostream_t& a_out) const noexcept;
 	};
+
+	/// \brief	Builds an \ref archive from many threads at once.
+	using archive_builder = components::sharded_builder<archive>;
 }
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <span>
 #include <string>
@@ -93,7 +94,15 @@ namespace bsa::tes4
 		normal,
 
 		/// \brief	The compression codec used for xbox archives.
-		xmem
+		xmem,
+
+		/// \brief	The default compression codec for \ref version::sse "sse" archives, except each
+		///		block of the lz4 frame is compressed independently of the others.
+		/// \details	The game reads these frames like any other, but large files can then be
+		///		decompressed in parallel. Only valid for \ref version::sse "sse" archives.
+		///		Decompression detects such frames automatically, so any codec except
+		///		\ref compression_codec::xmem "xmem" may be used to decompress them.
+		independent_blocks
 	};
 
 #ifndef DOXYGEN
@@ -184,10 +193,6 @@ namespace bsa::tes4
 			friend tes4::directory;
 #endif
 
-			void read(
-				detail::istream_t& a_in,
-				std::endian a_endian);
-
 			void write(
 				detail::ostream_t& a_out,
 				std::endian a_endian) const noexcept;
@@ -240,9 +245,13 @@ namespace bsa::tes4
 		///
 		/// \param	a_version	The version to compress the file for.
 		/// \param	a_codec	The codec to use.
+		/// \param	a_policy	The execution policy to compress with. Large files compressed for
+		///		zlib based versions may be split into blocks which are deflated in parallel,
+		///		yet still form a single zlib stream.
 		void compress(
 			version a_version,
-			compression_codec a_codec = compression_codec::normal);
+			compression_codec a_codec = compression_codec::normal,
+			execution_policy a_policy = execution_policy::sequential);
 
 		/// \copydoc bsa::doxygen_detail::compress_bound
 		///
@@ -256,10 +265,32 @@ namespace bsa::tes4
 		///
 		/// \param	a_version	The version to compress the file for.
 		/// \param	a_codec	The codec to use.
+		/// \param	a_policy	The execution policy to compress with.
 		[[nodiscard]] std::size_t compress_into(
 			version a_version,
 			std::span<std::byte> a_out,
-			compression_codec a_codec = compression_codec::normal) const;
+			compression_codec a_codec = compression_codec::normal,
+			execution_policy a_policy = execution_policy::sequential) const;
+
+		/// \brief	Compresses the file, but only if doing so meaningfully reduces its size.
+		/// \details	Payloads which are already compressed (audio, block compressed textures, etc.)
+		///		gain nothing from being compressed again, yet still cost time to decompress on every load.
+		///		Large files are first screened by trial compressing a leading sample. Files which are left
+		///		uncompressed are stored raw within a compressed archive by toggling their compression
+		///		independently of the archive's.
+		/// \pre	The file must *not* be \ref compressed() "compressed".
+		///
+		/// \param	a_version	The version to compress the file for.
+		/// \param	a_threshold	The largest ratio of compressed to decompressed size for which
+		///		the compressed data is kept.
+		/// \param	a_codec	The codec to use.
+		/// \param	a_policy	The execution policy to compress with.
+		/// \return	Returns `true` if the file was compressed, `false` if it was left as-is.
+		bool try_compress(
+			version a_version,
+			double a_threshold = 0.95,
+			compression_codec a_codec = compression_codec::normal,
+			execution_policy a_policy = execution_policy::sequential);
 
 		/// @}
 
@@ -270,17 +301,67 @@ namespace bsa::tes4
 		///
 		/// \param	a_version	The version to decompress the file for.
 		/// \param	a_codec	The codec to use.
+		/// \param	a_policy	The execution policy to decompress with. The blocks of
+		///		\ref compression_codec::independent_blocks "independent block" frames are
+		///		decompressed concurrently when parallel.
 		void decompress(
 			version a_version,
-			compression_codec a_codec = compression_codec::normal);
+			compression_codec a_codec = compression_codec::normal,
+			execution_policy a_policy = execution_policy::sequential);
 
 		/// \copydoc bsa::fo4::chunk::decompress_into
 		///
 		/// \param	a_version	The version to decompress the file for.
 		/// \param	a_codec	The codec to use.
+		/// \param	a_policy	The execution policy to decompress with.
 		void decompress_into(
 			version a_version,
 			std::span<std::byte> a_out,
+			compression_codec a_codec = compression_codec::normal,
+			execution_policy a_policy = execution_policy::sequential) const;
+
+		/// \brief	Extracts the decompressed contents of the file, reusing the given buffer.
+		/// \details	Uncompressed files are returned as a view directly into their
+		///		underlying data, without copying. Compressed files are decompressed into `a_buffer`,
+		///		which grows as needed.
+		///
+		/// \exception	bsa::compression_error	Thrown when any backend compression library errors
+		///		are encountered.
+		///
+		/// \param	a_version	The version to decompress the file for.
+		/// \param	a_buffer	The buffer to decompress the file into, if required.
+		/// \param	a_codec	The codec to use.
+		/// \param	a_policy	The execution policy to decompress with.
+		/// \return	A view of the decompressed contents of the file, which remains valid until
+		///		`a_buffer` is next used, or the file is modified.
+		[[nodiscard]] std::span<const std::byte> extract(
+			version a_version,
+			scratch_buffer& a_buffer,
+			compression_codec a_codec = compression_codec::normal,
+			execution_policy a_policy = execution_policy::sequential) const;
+
+		/// \brief	Reads a range of the decompressed contents of the file, reusing the given
+		///		buffer.
+		/// \details	Uncompressed files are returned as a view directly into their
+		///		underlying data, without copying. Compressed files are decompressed into `a_buffer`,
+		///		stopping as soon as the requested range has been produced.
+		///
+		/// \exception	bsa::compression_error	Thrown when any backend compression library errors
+		///		are encountered.
+		///
+		/// \param	a_version	The version to decompress the file for.
+		/// \param	a_offset	The offset into the decompressed contents to start reading at.
+		/// \param	a_length	The number of bytes to read.
+		/// \param	a_buffer	The buffer to decompress the range into, if required.
+		/// \param	a_codec	The codec to use.
+		/// \return	A view of the requested range, which remains valid until `a_buffer` is next
+		///		used, or the file is modified. The range is clamped to the
+		///		\ref decompressed_size() "decompressed size" of the file.
+		[[nodiscard]] std::span<const std::byte> read_range(
+			version a_version,
+			std::size_t a_offset,
+			std::size_t a_length,
+			scratch_buffer& a_buffer,
 			compression_codec a_codec = compression_codec::normal) const;
 
 		/// @}
@@ -371,14 +452,28 @@ namespace bsa::tes4
 
 		[[nodiscard]] auto compress_bound_xmem() const -> std::size_t;
 
-		[[nodiscard]] auto compress_into_lz4(std::span<std::byte> a_out) const -> std::size_t;
+		[[nodiscard]] auto compress_into_lz4(
+			std::span<std::byte> a_out,
+			compression_codec a_codec) const
+			-> std::size_t;
 		[[nodiscard]] auto compress_into_xmem(std::span<std::byte> a_out) const -> std::size_t;
-		[[nodiscard]] auto compress_into_zlib(std::span<std::byte> a_out) const -> std::size_t;
+		[[nodiscard]] auto compress_into_zlib(
+			std::span<std::byte> a_out,
+			execution_policy a_policy) const
+			-> std::size_t;
 
-		void decompress_into_lz4(std::span<std::byte> a_out) const;
+		void decompress_into_lz4(
+			std::span<std::byte> a_out,
+			execution_policy a_policy) const;
 		void decompress_into_xmem(std::span<std::byte> a_out) const;
 		void decompress_into_zlib(std::span<std::byte> a_out) const;
 
+		template <class Sink>
+		auto decompress_stream(
+			version a_version,
+			compression_codec a_codec,
+			Sink&& a_sink) const -> std::size_t;
+
 		void do_read(
 			detail::istream_t& a_in,
 			version a_version,
@@ -420,6 +515,40 @@ namespace bsa::tes4
 		/// @}
 	};
 
+	/// \brief	Options which control how an \ref archive is written.
+	struct write_options final
+	{
+		/// \brief	Writes each unique file payload only once, pointing the records of
+		///		byte-identical files at the same data.
+		/// \details	Payloads are fingerprinted by their size and checksum, and confirmed
+		///		byte-for-byte before being shared. Has no effect on archives with
+		///		\ref archive_flag::embedded_file_names "embedded file names", as each
+		///		payload is prefixed with its own name.
+		bool deduplicate{ false };
+
+		/// \brief	Aligns the start of each payload to a multiple of the given number of bytes,
+		///		padding the space between payloads with zeroes.
+		/// \details	Aligned payloads can be mapped, or handed off to consumers which require
+		///		aligned memory, directly from the archive. The alignment applies to the payload
+		///		itself, i.e. after any embedded file name or decompressed size which precedes it.
+		///		Values of 0 or 1 leave payloads packed back-to-back. Readers are unaffected, as each
+		///		file's record points directly at its data.
+		std::size_t alignment{ 0 };
+
+		/// \brief	Payloads smaller than the given number of bytes are left unaligned.
+		/// \details	Small payloads waste the most space when padded, and gain the least from it.
+		std::size_t alignment_threshold{ 0 };
+
+		/// \brief	The paths of files, in the order their payloads should be laid out.
+		/// \details	Payloads are laid out in the order given, and those which aren't listed follow
+		///		after, in the order of their records. The records themselves keep the order the format
+		///		requires. Paths which aren't in the archive are ignored.
+		/// \remark	The library doesn't record how an archive is accessed. To lay out payloads in the
+		///		order a consumer loads them, the caller must capture that order, e.g. by logging the
+		///		paths it looks up, and pass it here.
+		std::span<const std::string> payload_order{};
+	};
+
 	/// \brief	Represents the TES4 revision of the bsa format.
 	class archive final :
 		public components::hashmap<directory, true>
@@ -497,6 +626,81 @@ namespace bsa::tes4
 			super::clear();
 			_flags = archive_flag::none;
 			_types = archive_type::none;
+			_source.reset();
+		}
+
+		/// \brief	Transcodes the compressed files of the archive from one version's codec
+		///		to another's.
+		/// \details	Each compressed file is decompressed and then immediately recompressed
+		///		for `a_to`, reusing one pair of buffers per worker. The recompressed payloads are
+		///		spilled to a temporary file as they are produced, which the archive then maps in
+		///		place of the originals, so heap usage is bounded by the number of workers rather
+		///		than by the size of the archive. The temporary file is removed once no file
+		///		references it any longer.
+		///		Uncompressed files, and files whose codec is shared by both versions, are left untouched.
+		///		Writing the archive for `a_to` afterwards produces the new header and
+		///		directory records for that version.
+		///
+		/// \exception	bsa::compression_error	Thrown when any backend compression library errors
+		///		are encountered.
+		/// \exception	std::system_error	Thrown when filesystem errors are encountered.
+		///
+		/// \param	a_from	The version the archive's files are currently compressed for.
+		/// \param	a_to	The version to recompress the archive's files for.
+		/// \param	a_policy	The execution policy to transcode with. Files are transcoded
+		///		concurrently when parallel, but each file is always coded sequentially.
+		///
+		/// \remark	If \ref xbox_compressed() is set, files are assumed to be compressed with the
+		///		\ref compression_codec::xmem "xmem" codec, and the flag is cleared once they have
+		///		been transcoded.
+		/// \remark	If a compression error is thrown, then the contents of the archive are left
+		///		in a valid, but unspecified state.
+		void transcode(
+			version a_from,
+			version a_to,
+			execution_policy a_policy = execution_policy::parallel);
+
+		/// \brief	Merges the files of another archive into this one.
+		/// \details	Payloads are copied verbatim, so compressed files are never decompressed
+		///		or recompressed, and payloads mapped from disk continue to reference their
+		///		source mapping. Only the index is rebuilt when the archive is next written.
+		/// \pre	Both archives *must* be compressed for the same codec.
+		///
+		/// \param	a_other	The archive to merge files from.
+		/// \param	a_replace	Whether files which already exist in this archive should be
+		///		replaced by those in `a_other`.
+		/// \return	The number of files which were inserted or replaced.
+		std::size_t merge(
+			const archive& a_other,
+			bool a_replace = false);
+
+		/// @}
+
+		/// \name Residency
+		/// @{
+
+		/// \brief	Retrieves the residency hint of the archive's mapping.
+		/// \return	The hint, or `0` if it is disabled or the archive was not read from disk.
+		[[nodiscard]] std::size_t residency_hint() const noexcept
+		{
+			return _source ? _source->residency_hint() : 0;
+		}
+
+		/// \brief	Sets the residency hint of the archive's mapping, overriding the default given
+		///		by \ref bsa::residency_hint.
+		/// \details	The hint belongs to the mapping, so it is shared by every file and copy of
+		///		the archive which still references it. Lowering the hint immediately hands back
+		///		the least recently used regions beyond it. Does nothing if the archive was not read
+		///		from disk.
+		///
+		/// \param	a_bytes	The hint, in bytes. A hint of `0` disables it.
+		///
+		/// \warning	As with \ref bsa::residency_hint, the address space of the mapping is not bounded.
+		void residency_hint(std::size_t a_bytes) noexcept
+		{
+			if (_source) {
+				_source->residency_hint(a_bytes);
+			}
 		}
 
 		/// @}
@@ -506,36 +710,105 @@ namespace bsa::tes4
 
 		/// \copydoc bsa::tes3::archive::read(std::filesystem::path)
 		/// \copydoc bsa::tes4::archive::doxygen_read
-		version read(std::filesystem::path a_path);
+		version read(
+			std::filesystem::path a_path,
+			execution_policy a_policy = execution_policy::sequential);
 
 		/// \copydoc bsa::tes3::archive::read(std::span<const std::byte>, copy_type)
 		/// \copydoc bsa::tes4::archive::doxygen_read
 		version read(
 			std::span<const std::byte> a_src,
-			copy_type a_copy = copy_type::deep);
+			copy_type a_copy = copy_type::deep,
+			execution_policy a_policy = execution_policy::sequential);
 
 		/// @}
 
 		/// \name Verification
 		/// @{
 
-		/// \copydoc bsa::tes3::archive::verify_offsets
+		/// \copybrief bsa::tes3::archive::verify_offsets
+		/// \details	The archive is laid out exactly as \ref write would lay it out, so when
+		///		\ref write_options::deduplicate is set, every payload is read and compared.
+		///
+		/// \exception	std::bad_alloc	Thrown when the layout fails to be allocated.
 		///
 		/// \param	a_version	The version format to check for.
-		[[nodiscard]] bool verify_offsets(version a_version) const noexcept;
+		/// \param	a_options	The options the archive will be written with, as alignment and
+		///		deduplication move the offsets of payloads.
+		/// \return	Returns `true` is the archive passes validation, `false` otherwise.
+		[[nodiscard]] bool verify_offsets(
+			version a_version,
+			const write_options& a_options = {}) const;
 
 		/// @}
 
 		/// \name Writing
 		/// @{
 
+		/// \brief	Computes the size of the archive, as it would be written.
+		/// \details	Can be used to report the padding overhead of \ref write_options::alignment
+		///		without writing the archive.
+		///
+		/// \param	a_version	The version format to measure.
+		/// \param	a_options	The options to measure with.
+		/// \return	The size of the archive, and the padding within it.
+		[[nodiscard]] auto measure(
+			version a_version,
+			const write_options& a_options = {}) const
+			-> size_info;
+
 		/// \copydoc bsa::tes3::archive::write(std::filesystem::path) const
 		/// \copydoc bsa::tes4::archive::doxygen_write
-		void write(std::filesystem::path a_path, version a_version) const;
+		void write(
+			std::filesystem::path a_path,
+			version a_version,
+			const write_options& a_options = {}) const;
 
 		/// \copydoc bsa::tes3::archive::write(binary_io::any_ostream&) const
 		/// \copydoc bsa::tes4::archive::doxygen_write
-		void write(binary_io::any_ostream& a_dst, version a_version) const;
+		void write(
+			binary_io::any_ostream& a_dst,
+			version a_version,
+			const write_options& a_options = {}) const;
+
+		/// \brief	Writes the archive back to the file it was read from, without rewriting
+		///		the payloads which are already there.
+		/// \details	Payloads which are still mapped from `a_path`, and which don't overlap the
+		///		index, are left in place. New or changed payloads are appended to the end of the file,
+		///		and then the header, records, and string tables are rewritten. If the dead space
+		///		left behind by replaced or removed payloads would exceed `a_threshold` of the file,
+		///		or the archive was not read from disk, the archive is compacted by writing it in full
+		///		to a temporary file, which then replaces `a_path`. The archive is read back from
+		///		`a_path` afterwards.
+		///
+		///		The archive releases its mapping of `a_path` before the file is replaced or
+		///		opened for writing, as some platforms refuse to do either while it is mapped. Appended
+		///		payloads which are still mapped from `a_path` are copied into memory beforehand.
+		///		If the file can't be replaced or opened, it is read back as it was.
+		/// \pre	If the archive was read from disk, it *must* have been read from `a_path`.
+		/// \pre	No other archive, file, or copy of one *may* still reference payloads mapped from
+		///		`a_path`, or else the mapping outlives the release on platforms which lock mapped files.
+		///
+		/// \warning	Updating in place is neither atomic nor crash-safe. The index is rewritten only
+		///		after the appended payloads, so an interrupted update leaves the file indexing only its
+		///		old payloads, unless the new index was partially written, in which case the archive is
+		///		corrupt. Pass a negative `a_threshold` to always compact into a temporary file which
+		///		atomically replaces `a_path` instead.
+		///
+		/// \exception	bsa::exception	Thrown when the file fails to be updated.
+		/// \exception	std::system_error	Thrown when filesystem errors are encountered.
+		///
+		/// \param	a_path	The path of the archive to update.
+		/// \param	a_version	The version format to write the archive in.
+		/// \param	a_threshold	The largest fraction of the file which may be left as dead space
+		///		before the archive is compacted.
+		/// \param	a_options	The options to write with. Appended payloads are aligned as requested,
+		///		while \ref write_options::deduplicate "deduplication" only applies when compacting.
+		void update(
+			std::filesystem::path a_path,
+			version a_version,
+			double a_threshold = 0.25,
+			const write_options& a_options = {});
 
 		/// @}
 
@@ -544,36 +817,58 @@ namespace bsa::tes4
 		/// \name Doxygen only
 		/// @{
 
+		/// \param	a_policy	The execution policy to parse the index with. The file records
+		///		of each directory are parsed concurrently when parallel, which only pays off for
+		///		archives with many directories.
 		/// \return	The version of the archive that was read.
-		version doxygen_read();
+		version doxygen_read(execution_policy a_policy = execution_policy::sequential);
 
+		/// \exception	bsa::exception	Thrown when the offsets of the archive would exceed what
+		///		the format can hold. See \ref verify_offsets.
+		///
 		/// \param	a_version The version format to write the archive in.
-		void doxygen_write(version a_version) const;
+		/// \param	a_options	The options to write the archive with.
+		void doxygen_write(
+			version a_version,
+			const write_options& a_options = {}) const;
 
 		/// @}
 #endif
 
 	private:
-		using intermediate_t =
-			std::vector<
-				std::pair<
-					const value_type*,
-					std::vector<const mapped_type::value_type*>>>;
+		struct layout_t;
+
+		[[nodiscard]] auto do_read(
+			detail::istream_t& a_in,
+			execution_policy a_policy) -> version;
+
+		void do_write(
+			detail::ostream_t& a_out,
+			version a_version,
+			const write_options& a_options) const;
 
-		struct xbox_sort_t;
+		void find_shared_data(
+			layout_t& a_layout,
+			const write_options& a_options) const;
 
-		[[nodiscard]] auto do_read(detail::istream_t& a_in) -> version;
+		void layout_file_data(
+			layout_t& a_layout,
+			const write_options& a_options) const;
 
-		void do_write(detail::ostream_t& a_out, version a_version) const;
+		[[nodiscard]] auto plan_layout(
+			version a_version,
+			const write_options& a_options) const
+			-> layout_t;
 
-		[[nodiscard]] auto make_header(version a_version) const noexcept -> detail::header_t;
+		[[nodiscard]] auto plan_records(version a_version) const -> layout_t;
 
+		template <class Records>
 		[[nodiscard]] auto read_file_entries(
 			directory& a_dir,
 			detail::istream_t& a_in,
 			const detail::header_t& a_header,
 			std::size_t a_count,
-			std::size_t& a_namesOffset) -> std::optional<std::string_view>;
+			std::span<const std::string_view>& a_names) -> std::optional<std::string_view>;
 
 		void read_file_data(
 			file& a_file,
@@ -581,13 +876,12 @@ namespace bsa::tes4
 			const detail::header_t& a_header,
 			std::size_t a_size);
 
-		void read_directory(
+		template <class Records>
+		void read_directories(
 			detail::istream_t& a_in,
 			const detail::header_t& a_header,
-			std::size_t& a_filesOffset,
-			std::size_t& a_namesOffset);
-
-		[[nodiscard]] auto sort_for_write(bool a_xbox) const noexcept -> intermediate_t;
+			std::span<const std::string_view> a_names,
+			execution_policy a_policy);
 
 		[[nodiscard]] auto test_flag(archive_flag a_flag) const noexcept
 			-> bool { return (_flags & a_flag) != archive_flag::none; }
@@ -596,25 +890,26 @@ namespace bsa::tes4
 			-> bool { return (_types & a_type) != archive_type::none; }
 
 		void write_directory_entries(
-			const intermediate_t& a_intermediate,
-			detail::ostream_t& a_out,
-			const detail::header_t& a_header) const noexcept;
+			const layout_t& a_layout,
+			detail::ostream_t& a_out) const noexcept;
 
 		void write_file_data(
-			const intermediate_t& a_intermediate,
-			detail::ostream_t& a_out,
-			const detail::header_t& a_header) const noexcept;
+			const layout_t& a_layout,
+			detail::ostream_t& a_out) const noexcept;
 
 		void write_file_entries(
-			const intermediate_t& a_intermediate,
-			detail::ostream_t& a_out,
-			const detail::header_t& a_header) const noexcept;
+			const layout_t& a_layout,
+			detail::ostream_t& a_out) const noexcept;
 
 		void write_file_names(
-			const intermediate_t& a_intermediate,
+			const layout_t& a_layout,
 			detail::ostream_t& a_out) const noexcept;
 
 		archive_flag _flags{ archive_flag::none };
 		archive_type _types{ archive_type::none };
+		std::shared_ptr<detail::istream_t::file_type> _source;
 	};
+
+	/// \brief	Builds an \ref archive from many threads at once.
+	using archive_builder = components::sharded_builder<archive>;
 }
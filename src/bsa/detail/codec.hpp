@@ -0,0 +1,359 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <lz4.h>
+#include <lz4frame.h>
+#include <zlib.h>
+
+#include "bsa/detail/common.hpp"
+#include "bsa/detail/parallel.hpp"
+
+namespace bsa::detail
+{
+	// the size of the window used when streaming decompressed data,
+	//	which bounds the memory used regardless of the size of the payload
+	inline constexpr std::size_t stream_window_size = 1u << 16u;
+
+	// Inflates the given zlib stream through a fixed size window, handing each decoded
+	//	run of bytes to the sink. The sink may return false to stop decoding early.
+	// Returns the number of decoded bytes given to the sink.
+	template <class Sink>
+	auto inflate_stream(
+		std::span<const std::byte> a_in,
+		Sink&& a_sink)
+		-> std::size_t
+	{
+		::z_stream stream = {};
+		if (const auto result = ::inflateInit(&stream);
+			result != Z_OK) {
+			throw bsa::compression_error(bsa::compression_error::library::zlib, result);
+		}
+		std::unique_ptr<::z_stream, decltype(&::inflateEnd)> guard{ &stream, ::inflateEnd };
+
+		std::array<std::byte, stream_window_size> window;
+		stream.next_in = (z_const ::Bytef*)a_in.data();
+		stream.avail_in = 0;
+
+		auto insz = a_in.size_bytes();
+		std::size_t total = 0;
+		int error = Z_OK;
+		do {
+			if (stream.avail_in == 0) {
+				stream.avail_in = static_cast<::uInt>(
+					std::min<std::size_t>((std::numeric_limits<::uInt>::max)(), insz));
+				insz -= stream.avail_in;
+			}
+
+			stream.next_out = reinterpret_cast<::Bytef*>(window.data());
+			stream.avail_out = static_cast<::uInt>(window.size());
+			error = ::inflate(&stream, Z_NO_FLUSH);
+			if (error != Z_OK && error != Z_STREAM_END) {
+				throw bsa::compression_error(bsa::compression_error::library::zlib, error);
+			}
+
+			const auto outsz = window.size() - stream.avail_out;
+			total += outsz;
+			if (outsz > 0 && !a_sink(std::span{ window.data(), outsz })) {
+				return total;
+			}
+		} while (error != Z_STREAM_END);
+
+		return total;
+	}
+
+	// Decompresses the given lz4 frame through a fixed size window, handing each decoded
+	//	run of bytes to the sink. The sink may return false to stop decoding early.
+	// Returns the number of decoded bytes given to the sink.
+	template <class Sink>
+	auto lz4f_stream(
+		std::span<const std::byte> a_in,
+		Sink&& a_sink)
+		-> std::size_t
+	{
+		::LZ4F_dctx* pdctx = nullptr;
+		if (const auto result = ::LZ4F_createDecompressionContext(&pdctx, LZ4F_VERSION);
+			::LZ4F_isError(result)) {
+			throw bsa::compression_error(bsa::compression_error::library::lz4, result);
+		}
+		std::unique_ptr<::LZ4F_dctx, decltype(&::LZ4F_freeDecompressionContext)> dctx{
+			pdctx,
+			::LZ4F_freeDecompressionContext
+		};
+
+		// the window is reused between calls, so the destination is *not* stable
+		constexpr ::LZ4F_decompressOptions_t options = {};
+
+		std::array<std::byte, stream_window_size> window;
+		const std::byte* inptr = a_in.data();
+		const std::byte* const inend = inptr + a_in.size_bytes();
+		std::size_t total = 0;
+		std::size_t result = 0;
+		do {
+			auto insz = static_cast<std::size_t>(inend - inptr);
+			auto outsz = window.size();
+			result = ::LZ4F_decompress(
+				dctx.get(),
+				window.data(),
+				&outsz,
+				inptr,
+				&insz,
+				&options);
+			if (::LZ4F_isError(result)) {
+				throw bsa::compression_error(bsa::compression_error::library::lz4, result);
+			}
+
+			inptr += insz;
+			total += outsz;
+			if (outsz > 0 && !a_sink(std::span{ window.data(), outsz })) {
+				return total;
+			}
+
+			if (insz == 0 && outsz == 0 && result != 0) {
+				throw bsa::compression_error(detail::error_code::decompress_size_mismatch);
+			}
+		} while (result != 0);
+
+		return total;
+	}
+
+	// the size of the blocks which are deflated concurrently
+	inline constexpr std::size_t deflate_parallel_block_size = 1u << 17u;
+
+	// Compresses the input into a single zlib stream by deflating fixed size blocks concurrently,
+	//	in the manner of pigz. Each block is primed with the window preceding it, and ends on a
+	//	sync flush boundary, so the raw blocks can be stitched together between a zlib header
+	//	and the combined adler32 of the blocks.
+	// Returns std::nullopt if the policy is sequential, if the input is too small to be split,
+	//	or if the stitched stream would not fit in the output, in which case the caller should
+	//	fall back to a serial compressor.
+	[[nodiscard]] inline auto deflate_parallel(
+		std::span<const std::byte> a_in,
+		std::span<std::byte> a_out,
+		int a_level,
+		int a_windowBits,
+		execution_policy a_policy)
+		-> std::optional<std::size_t>
+	{
+		const auto blocksz = deflate_parallel_block_size;
+		const auto count = (a_in.size() + blocksz - 1) / blocksz;
+		if (a_policy != execution_policy::parallel || count < 2) {
+			return std::nullopt;
+		}
+
+		// every block is deflated into its own fixed size slot of a single buffer
+		const auto dictsz = std::size_t{ 1 } << a_windowBits;
+		const auto slotsz = static_cast<std::size_t>(::compressBound(static_cast<::uLong>(blocksz))) + 0x10;
+		std::vector<std::byte> scratch(count * slotsz);
+		std::vector<std::size_t> sizes(count);
+		std::vector<::uLong> checksums(count);
+		std::atomic_bool overflow{ false };
+		parallel_for(count, [&](std::size_t a_idx) {
+			const auto pos = a_idx * blocksz;
+			const auto in = a_in.subspan(pos, (std::min)(blocksz, a_in.size() - pos));
+			const bool last = a_idx + 1 == count;
+
+			::z_stream stream = {};
+			if (const auto result = ::deflateInit2(
+					&stream,
+					a_level,
+					Z_DEFLATED,
+					-a_windowBits,
+					8,
+					Z_DEFAULT_STRATEGY);
+				result != Z_OK) {
+				throw bsa::compression_error(bsa::compression_error::library::zlib, result);
+			}
+			std::unique_ptr<::z_stream, decltype(&::deflateEnd)> guard{ &stream, ::deflateEnd };
+
+			if (pos > 0) {
+				const auto dict = a_in.subspan(pos - (std::min)(dictsz, pos), (std::min)(dictsz, pos));
+				if (const auto result = ::deflateSetDictionary(
+						&stream,
+						reinterpret_cast<const ::Bytef*>(dict.data()),
+						static_cast<::uInt>(dict.size()));
+					result != Z_OK) {
+					throw bsa::compression_error(bsa::compression_error::library::zlib, result);
+				}
+			}
+
+			stream.next_in = (z_const ::Bytef*)in.data();
+			stream.avail_in = static_cast<::uInt>(in.size());
+			stream.next_out = reinterpret_cast<::Bytef*>(scratch.data() + a_idx * slotsz);
+			stream.avail_out = static_cast<::uInt>(slotsz);
+			const auto error = ::deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+			if (error == Z_OK && (stream.avail_in != 0 || stream.avail_out == 0)) {
+				// the block didn't fit its slot
+				overflow = true;
+				return;
+			} else if (error != (last ? Z_STREAM_END : Z_OK)) {
+				throw bsa::compression_error(bsa::compression_error::library::zlib, error);
+			}
+
+			sizes[a_idx] = stream.total_out;
+			checksums[a_idx] = ::adler32(
+				::adler32(0, nullptr, 0),
+				reinterpret_cast<const ::Bytef*>(in.data()),
+				static_cast<::uInt>(in.size()));
+		});
+
+		if (overflow) {
+			return std::nullopt;
+		}
+
+		std::size_t total = 2 + 4;
+		for (const auto size : sizes) {
+			total += size;
+		}
+		if (total > a_out.size()) {
+			return std::nullopt;
+		}
+
+		const auto flevel =
+			a_level == Z_DEFAULT_COMPRESSION ? 2u :
+			a_level < 2                      ? 0u :
+			a_level < 6                      ? 1u :
+			a_level == 6                     ? 2u :
+                                               3u;
+		auto header = ((static_cast<unsigned>(a_windowBits - 8) << 4u | Z_DEFLATED) << 8u) | (flevel << 6u);
+		header += 31u - header % 31u;
+
+		auto out = a_out.begin();
+		*out++ = static_cast<std::byte>(header >> 8u);
+		*out++ = static_cast<std::byte>(header & 0xFFu);
+
+		auto adler = checksums[0];
+		for (std::size_t i = 0; i < count; ++i) {
+			const auto block = scratch.begin() + static_cast<std::ptrdiff_t>(i * slotsz);
+			out = std::copy(block, block + static_cast<std::ptrdiff_t>(sizes[i]), out);
+			if (i > 0) {
+				const auto len = (std::min)(blocksz, a_in.size() - i * blocksz);
+				adler = ::adler32_combine(adler, checksums[i], static_cast<::z_off_t>(len));
+			}
+		}
+
+		for (std::size_t i = 0; i < 4; ++i) {
+			*out++ = static_cast<std::byte>((adler >> (24u - i * 8u)) & 0xFFu);
+		}
+
+		return total;
+	}
+
+	// the fewest blocks a frame must contain before it is worth decoding them concurrently
+	inline constexpr std::size_t lz4f_parallel_block_minimum = 4;
+
+	// Decodes an lz4 frame written with independent blocks by walking its block headers,
+	//	and decompressing each block into its known offset in the output, concurrently
+	//	when parallel.
+	// Returns false, without touching the output, if the frame does not use independent
+	//	blocks, carries block or content checksums, or contains too few blocks to be worth
+	//	the effort, in which case the caller should fall back to a serial decoder (which
+	//	verifies the checksums). Returns false with the output in an unspecified state if
+	//	the blocks do not fill their maximum size.
+	[[nodiscard]] inline bool lz4f_decompress_independent(
+		std::span<const std::byte> a_in,
+		std::span<std::byte> a_out,
+		execution_policy a_policy)
+	{
+		const auto read_u32 = [&](std::size_t a_pos) noexcept {
+			std::uint32_t result = 0;
+			for (std::size_t i = 0; i < 4; ++i) {
+				result |= std::to_integer<std::uint32_t>(a_in[a_pos + i]) << (i * 8u);
+			}
+			return result;
+		};
+
+		constexpr std::uint32_t magic = 0x184D2204;
+		if (a_in.size() < 7 || read_u32(0) != magic) {
+			return false;
+		}
+
+		const auto flags = std::to_integer<std::uint8_t>(a_in[4]);
+		const auto descriptor = std::to_integer<std::uint8_t>(a_in[5]);
+		const bool independent = (flags & (1u << 5u)) != 0;
+		const bool blockChecksum = (flags & (1u << 4u)) != 0;
+		const bool contentSize = (flags & (1u << 3u)) != 0;
+		const bool contentChecksum = (flags & (1u << 2u)) != 0;
+		const bool dictID = (flags & (1u << 0u)) != 0;
+		if ((flags >> 6u) != 1u || !independent || blockChecksum || contentChecksum || dictID) {
+			return false;
+		}
+
+		const auto blockMax = std::size_t{ 1 } << (8u + 2u * ((descriptor >> 4u) & 0x7u));
+		std::size_t pos = 4 + 2 + (contentSize ? 8 : 0) + 1;
+
+		struct block_t
+		{
+			std::span<const std::byte> in;
+			bool compressed;
+		};
+
+		std::vector<block_t> blocks;
+		blocks.reserve(a_out.size() / blockMax + 1);
+		for (;;) {
+			if (pos + 4 > a_in.size()) {
+				return false;
+			}
+			const auto header = read_u32(pos);
+			pos += 4;
+			if (header == 0) {
+				break;
+			}
+
+			const auto size = std::size_t{ header & 0x7FFFFFFFu };
+			if (pos + size > a_in.size()) {
+				return false;
+			}
+			blocks.push_back({ a_in.subspan(pos, size), (header & 0x80000000u) == 0 });
+			pos += size;
+		}
+
+		if (blocks.size() < lz4f_parallel_block_minimum ||
+			blocks.size() != (a_out.size() + blockMax - 1) / blockMax) {
+			return false;
+		}
+
+		std::atomic_bool ok{ true };
+		const auto decode = [&](std::size_t a_idx) {
+			const auto& block = blocks[a_idx];
+			const auto out = a_out.subspan(
+				a_idx * blockMax,
+				(std::min)(blockMax, a_out.size() - a_idx * blockMax));
+			if (block.compressed) {
+				const auto result = ::LZ4_decompress_safe(
+					reinterpret_cast<const char*>(block.in.data()),
+					reinterpret_cast<char*>(out.data()),
+					static_cast<int>(block.in.size()),
+					static_cast<int>(out.size()));
+				if (result < 0) {
+					throw bsa::compression_error(error_code::lz4_block_decompress_failure);
+				} else if (static_cast<std::size_t>(result) != out.size()) {
+					ok = false;
+				}
+			} else if (block.in.size() == out.size()) {
+				std::copy(block.in.begin(), block.in.end(), out.begin());
+			} else {
+				ok = false;
+			}
+		};
+
+		if (a_policy == execution_policy::parallel) {
+			parallel_for(blocks.size(), decode);
+		} else {
+			for (std::size_t i = 0; i < blocks.size(); ++i) {
+				decode(i);
+			}
+		}
+
+		return ok;
+	}
+}
@@ -1,21 +1,38 @@
 #include "bsa/detail/common.hpp"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <functional>
 #include <limits>
 #include <optional>
 #include <span>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <tuple>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include <lz4frame.h>
 #include <zlib.h>
 
+#if BSA_OS_WINDOWS
+#	define WIN32_LEAN_AND_MEAN
+#	define NOMINMAX
+#	include <Windows.h>
+#else
+#	include <sys/mman.h>
+#endif
+
+#include "bsa/detail/parallel.hpp"
+
 #ifdef BSA_SUPPORT_XMEM
 #	include "bsa/xmem/xmem.hpp"
 #endif
@@ -53,6 +70,21 @@ namespace bsa
 		detail::istream_t in{ a_src, copy_type::shallow };
 		return guess_file_format(in);
 	}
+
+	namespace
+	{
+		std::atomic_size_t g_residencyHint{ 0 };
+	}
+
+	std::size_t residency_hint() noexcept
+	{
+		return g_residencyHint;
+	}
+
+	void residency_hint(std::size_t a_bytes) noexcept
+	{
+		g_residencyHint = a_bytes;
+	}
 }
 
 namespace bsa::detail
@@ -79,6 +111,22 @@ namespace bsa::detail
 
 			return lut[static_cast<unsigned char>(a_ch)];
 		}
+
+		// finds the null-terminated string at the front of the given bytes
+		[[nodiscard]] auto scan_zstring(std::span<const std::byte> a_src)
+			-> std::string_view
+		{
+			const auto first = reinterpret_cast<const char*>(a_src.data());
+			const auto last =
+				!a_src.empty() ?
+					static_cast<const char*>(std::memchr(first, '\0', a_src.size())) :
+					nullptr;
+			if (!last) {
+				throw binary_io::buffer_exhausted();
+			}
+
+			return { first, static_cast<std::size_t>(last - first) };
+		}
 	}
 
 	void normalize_path(std::string& a_path) noexcept
@@ -133,13 +181,41 @@ namespace bsa::detail
 	auto read_zstring(detail::istream_t& a_in)
 		-> std::string_view
 	{
-		const auto first = reinterpret_cast<const char*>(a_in->read_bytes(1u).data());
-		auto last = first;
-		do {
-			++last;
-		} while (std::get<0>(a_in->read<char>()) != '\0');
+		const auto buf = a_in->rdbuf();
+		const auto pos = static_cast<std::size_t>(a_in->tell());
+		const auto name = scan_zstring(pos < buf.size() ? buf.subspan(pos) : std::span<const std::byte>{});
+		(void)a_in->read_bytes(name.length() + 1u);  // include null terminator
+		return name;
+	}
+
+	auto split_zstrings(
+		std::span<const std::byte> a_table,
+		std::size_t a_count)
+		-> std::vector<std::string_view>
+	{
+		std::vector<std::string_view> result;
+		result.reserve(a_count);
+		for (std::size_t i = 0; i < a_count; ++i) {
+			const auto name = scan_zstring(a_table);
+			result.push_back(name);
+			a_table = a_table.subspan(name.length() + 1u);
+		}
+
+		return result;
+	}
 
-		return { first, last };
+	void for_each_index(
+		std::size_t a_count,
+		const std::function<void(std::size_t)>& a_func,
+		execution_policy a_policy)
+	{
+		if (a_policy == execution_policy::parallel) {
+			parallel_for(a_count, a_func);
+		} else {
+			for (std::size_t i = 0; i < a_count; ++i) {
+				a_func(i);
+			}
+		}
 	}
 
 	void write_bzstring(detail::ostream_t& a_out, std::string_view a_string) noexcept
@@ -148,6 +224,16 @@ namespace bsa::detail
 		write_zstring(a_out, a_string);
 	}
 
+	void write_padding(detail::ostream_t& a_out, std::size_t a_count) noexcept
+	{
+		static constexpr std::array<std::byte, 0x1000> zeroes{};
+		while (a_count > 0) {
+			const auto count = (std::min)(a_count, zeroes.size());
+			a_out.write_bytes({ zeroes.data(), count });
+			a_count -= count;
+		}
+	}
+
 	void write_wstring(detail::ostream_t& a_out, std::string_view a_string) noexcept
 	{
 		a_out.write(static_cast<std::uint16_t>(a_string.length()));
@@ -164,8 +250,108 @@ namespace bsa::detail
 		a_out.write(std::byte{ '\0' });
 	}
 
-	istream_t::istream_t(std::filesystem::path a_path) :
-		_file(std::make_shared<file_type>(std::move(a_path))),
+	mapped_source::mapped_source(std::filesystem::path a_path, bool a_temporary) :
+		_file(a_path),
+		_hint(bsa::residency_hint())
+	{
+		if (a_temporary) {
+			_temporary = std::move(a_path);
+		}
+	}
+
+	mapped_source::~mapped_source() noexcept
+	{
+		if (!_temporary.empty()) {
+			_file.close();
+			std::error_code ec;
+			std::filesystem::remove(_temporary, ec);
+		}
+	}
+
+	void mapped_source::residency_hint(std::size_t a_bytes) noexcept
+	{
+		const std::scoped_lock l{ _lock };
+		_hint.store(a_bytes, std::memory_order_relaxed);
+		if (a_bytes == 0) {
+			// untracked windows are left as they are, just as they were before the hint was set
+			_lru.clear();
+			_windows.clear();
+			_mru.store(no_window, std::memory_order_relaxed);
+		} else {
+			this->shrink(a_bytes / window_size);
+		}
+	}
+
+	std::size_t mapped_source::resident_windows() const noexcept
+	{
+		const std::scoped_lock l{ _lock };
+		return _lru.size();
+	}
+
+	void mapped_source::touch(std::span<const std::byte> a_range) noexcept
+	{
+		const auto hint = _hint.load(std::memory_order_relaxed);
+		if (hint == 0 || a_range.empty()) {
+			return;
+		}
+
+		assert(a_range.data() >= _file.data());
+		const auto offset = static_cast<std::size_t>(a_range.data() - _file.data());
+		assert(offset + a_range.size() <= _file.size());
+		const auto first = offset / window_size;
+		const auto last = (offset + a_range.size() - 1) / window_size;
+
+		// the most recently used window can't be reordered, nor evicted by touching it again.
+		//	this is read outside of the lock, but a stale read only skips reordering a window,
+		//	which the hint can tolerate
+		if (first == last && _mru.load(std::memory_order_relaxed) == first) {
+			return;
+		}
+
+		const std::scoped_lock l{ _lock };
+		for (auto i = first; i <= last; ++i) {
+			if (const auto it = _windows.find(i); it != _windows.end()) {
+				_lru.splice(_lru.begin(), _lru, it->second);
+			} else {
+				_lru.push_front(i);
+				_windows.emplace(i, _lru.begin());
+			}
+		}
+		_mru.store(last, std::memory_order_relaxed);
+
+		// the windows which were just touched are never evicted
+		this->shrink((std::max)(hint / window_size, last - first + 1));
+	}
+
+	void mapped_source::evict(std::size_t a_window) noexcept
+	{
+		const auto offset = a_window * window_size;
+		const auto length = (std::min)(window_size, _file.size() - offset);
+		const auto ptr = const_cast<std::byte*>(_file.data() + offset);
+#if BSA_OS_WINDOWS
+		// unlocking pages which aren't locked removes them from the working set
+		::VirtualUnlock(ptr, length);
+#else
+		// the mapping is read-only, so its pages are simply faulted back in from the file
+		::madvise(ptr, length, MADV_DONTNEED);
+#endif
+	}
+
+	void mapped_source::shrink(std::size_t a_capacity) noexcept
+	{
+		while (_lru.size() > a_capacity) {
+			const auto window = _lru.back();
+			if (window == _mru.load(std::memory_order_relaxed)) {
+				_mru.store(no_window, std::memory_order_relaxed);
+			}
+			this->evict(window);
+			_windows.erase(window);
+			_lru.pop_back();
+		}
+	}
+
+	istream_t::istream_t(std::filesystem::path a_path, bool a_temporary) :
+		_file(std::make_shared<file_type>(std::move(a_path), a_temporary)),
 		_stream({ _file->data(), _file->size() }),
 		_copy(copy_type::shallow)
 	{
@@ -178,6 +364,17 @@ namespace bsa::detail
 	{
 		_stream.endian(std::endian::little);
 	}
+
+	istream_t::istream_t(
+		std::shared_ptr<file_type> a_file,
+		std::span<const std::byte> a_bytes,
+		copy_type a_copy) noexcept :
+		_file(std::move(a_file)),
+		_stream(a_bytes),
+		_copy(a_copy)
+	{
+		_stream.endian(std::endian::little);
+	}
 }
 
 namespace bsa
@@ -227,7 +424,11 @@ namespace bsa::components
 				};
 			}
 		case data_proxied:
-			return std::get_if<data_proxied>(&_data)->d;
+			{
+				const auto& proxy = *std::get_if<data_proxied>(&_data);
+				proxy.f->touch(proxy.d);
+				return proxy.d;
+			}
 		default:
 			detail::declare_unreachable();
 		}
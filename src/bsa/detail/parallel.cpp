@@ -0,0 +1,63 @@
+#include "bsa/detail/parallel.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace bsa::detail
+{
+	thread_pool& thread_pool::get()
+	{
+		static thread_pool singleton;
+		return singleton;
+	}
+
+	void thread_pool::submit(std::function<void()> a_job)
+	{
+		{
+			const std::scoped_lock l{ _lock };
+			_jobs.push_back(std::move(a_job));
+		}
+		_ready.notify_one();
+	}
+
+	thread_pool::thread_pool()
+	{
+		const auto count = (std::max)(std::thread::hardware_concurrency(), 1u) - 1;
+		_workers.reserve(count);
+		for (std::size_t i = 0; i < count; ++i) {
+			_workers.emplace_back([this]() noexcept { this->run(); });
+		}
+	}
+
+	thread_pool::~thread_pool() noexcept
+	{
+		{
+			const std::scoped_lock l{ _lock };
+			_stopping = true;
+		}
+		_ready.notify_all();
+		for (auto& worker : _workers) {
+			worker.join();
+		}
+	}
+
+	void thread_pool::run() noexcept
+	{
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock l{ _lock };
+				_ready.wait(l, [&]() noexcept { return _stopping || !_jobs.empty(); });
+				if (_jobs.empty()) {
+					return;
+				}
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+			}
+			job();
+		}
+	}
+}
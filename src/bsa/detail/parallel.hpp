@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bsa::detail
+{
+	// set while a thread is doing the work of a parallel_for
+	inline thread_local bool parallel_worker = false;
+
+	// A fixed set of worker threads, shared by every parallel_for in the process.
+	// The pool is started on first use, and sized so that, together with the thread which
+	//	submits the work, it occupies every hardware thread.
+	class thread_pool final
+	{
+	public:
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		[[nodiscard]] static thread_pool& get();
+
+		[[nodiscard]] std::size_t size() const noexcept { return _workers.size(); }
+
+		void submit(std::function<void()> a_job);
+
+	private:
+		thread_pool();
+		~thread_pool() noexcept;
+
+		void run() noexcept;
+
+		std::mutex _lock;
+		std::condition_variable _ready;
+		std::deque<std::function<void()>> _jobs;
+		bool _stopping{ false };
+		std::vector<std::thread> _workers;
+	};
+
+	// Invokes the given function once for every index in [0, a_count), spreading the
+	//	work across the shared thread pool. The calling thread participates in the work,
+	//	so the call completes even if every pool thread is busy with other work.
+	// Calls made from within the work of another parallel_for run inline on the calling thread,
+	//	so that nested parallelism never occupies more threads than there is hardware for.
+	// If any invocation throws, the remaining indices are abandoned, and the first exception
+	//	is rethrown once all workers have finished.
+	template <class F>
+	void parallel_for(
+		std::size_t a_count,
+		F&& a_func)
+	{
+		if (a_count <= 1 || parallel_worker) {
+			for (std::size_t i = 0; i < a_count; ++i) {
+				a_func(i);
+			}
+			return;
+		}
+
+		auto& pool = thread_pool::get();
+		const auto helpers = (std::min)(pool.size(), a_count - 1);
+		if (helpers == 0) {
+			for (std::size_t i = 0; i < a_count; ++i) {
+				a_func(i);
+			}
+			return;
+		}
+
+		std::atomic_size_t next{ 0 };
+		std::exception_ptr error;
+		std::mutex lock;
+		const auto work = [&]() noexcept {
+			const bool nested = std::exchange(parallel_worker, true);
+			try {
+				for (auto i = next++; i < a_count; i = next++) {
+					a_func(i);
+				}
+			} catch (...) {
+				next = a_count;
+				const std::scoped_lock l{ lock };
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			parallel_worker = nested;
+		};
+
+		// jobs which only start once the caller has finished must not touch its frame,
+		//	so they share this state, and only join the work while it is still open
+		struct state_t final
+		{
+			std::mutex lock;
+			std::condition_variable idle;
+			std::size_t active{ 0 };
+			bool closed{ false };
+			std::function<void()> work;
+		};
+
+		const auto state = std::make_shared<state_t>();
+		state->work = std::ref(work);
+		for (std::size_t i = 0; i < helpers; ++i) {
+			pool.submit([state]() {
+				{
+					const std::scoped_lock l{ state->lock };
+					if (state->closed) {
+						return;
+					}
+					++state->active;
+				}
+				state->work();
+				{
+					const std::scoped_lock l{ state->lock };
+					--state->active;
+				}
+				state->idle.notify_all();
+			});
+		}
+
+		work();
+		{
+			std::unique_lock l{ state->lock };
+			state->closed = true;
+			state->idle.wait(l, [&]() noexcept { return state->active == 0; });
+		}
+
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+}
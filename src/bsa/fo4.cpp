@@ -2,22 +2,33 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <limits>
 #include <optional>
 #include <span>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <binary_io/any_stream.hpp>
 #include <binary_io/file_stream.hpp>
+#include <binary_io/memory_stream.hpp>
+#include <lz4.h>
+#include <lz4hc.h>
 #include <zlib.h>
 
 #include <DirectXTex.h>
 
+#include "bsa/detail/codec.hpp"
+
 namespace bsa::fo4
 {
 	namespace detail
@@ -28,7 +39,9 @@ namespace bsa::fo4
 			{
 				constexpr auto btdx = make_four_cc("BTDX"sv);
 
-				constexpr std::size_t header_size = 0x18;
+				constexpr std::size_t header_size_v1 = 0x18;
+				constexpr std::size_t header_size_v2 = 0x20;
+				constexpr std::size_t header_size_v3 = 0x24;
 
 				constexpr std::size_t chunk_header_size_gnrl = 0x10;
 				constexpr std::size_t chunk_header_size_dx10 = 0x18;
@@ -37,24 +50,54 @@ namespace bsa::fo4
 				constexpr std::size_t chunk_size_dx10 = 0x18;
 
 				constexpr std::size_t chunk_sentinel = 0xBAADF00D;
+
+				constexpr auto dds = make_four_cc("DDS "sv);
+				constexpr auto dx10 = make_four_cc("DX10"sv);
+
+				constexpr std::size_t dds_header_size = 0x80;  // including the magic
+				constexpr std::size_t dx10_header_size = 0x14;
+
+				constexpr std::uint32_t ddsd_texture = 0x1007;  // caps | height | width | pixelformat
+				constexpr std::uint32_t ddsd_pitch = 0x8;
+				constexpr std::uint32_t ddsd_mipmapcount = 0x20000;
+				constexpr std::uint32_t ddsd_linearsize = 0x80000;
+				constexpr std::uint32_t ddsd_depth = 0x800000;
+
+				constexpr std::uint32_t ddpf_alphapixels = 0x1;
+				constexpr std::uint32_t ddpf_alpha = 0x2;
+				constexpr std::uint32_t ddpf_fourcc = 0x4;
+				constexpr std::uint32_t ddpf_rgb = 0x40;
+				constexpr std::uint32_t ddpf_luminance = 0x20000;
+				constexpr std::uint32_t ddpf_bumpdudv = 0x80000;
+
+				constexpr std::uint32_t ddscaps_complex = 0x8;
+				constexpr std::uint32_t ddscaps_texture = 0x1000;
+				constexpr std::uint32_t ddscaps_mipmap = 0x400000;
+
+				constexpr std::uint32_t ddscaps2_cubemap = 0x200;
+				constexpr std::uint32_t ddscaps2_cubemap_allfaces = 0xFC00;
+				constexpr std::uint32_t ddscaps2_volume = 0x200000;
+
+				constexpr std::uint32_t resource_dimension_texture2d = 3;
+				constexpr std::uint32_t resource_misc_texturecube = 0x4;
 			}
 		}
 
 		namespace
 		{
-			template <std::size_t MAX_COUNT>
 			[[nodiscard]] auto chunk(
 				std::span<const DirectX::Image> a_range,
-				std::size_t a_chunksz) noexcept
+				std::size_t a_chunksz,
+				std::size_t a_maxCount) noexcept
 			{
-				static_assert(MAX_COUNT > 0);
+				const auto maxCount = (std::max)(a_maxCount, std::size_t{ 1 });
 
 				std::vector<std::span<const DirectX::Image>> result;
 				if (a_range.empty()) {
 					return result;
 				}
 
-				result.reserve(MAX_COUNT);
+				result.reserve((std::min)(maxCount, a_range.size()));
 				std::size_t start = 0;
 				std::size_t size = 0;
 				std::size_t i = 0;
@@ -71,8 +114,8 @@ namespace bsa::fo4
 				}
 
 				result.push_back(a_range.subspan(start, i - start));
-				if (result.size() > MAX_COUNT) {
-					result.erase(result.begin() + MAX_COUNT, result.end());
+				if (result.size() > maxCount) {
+					result.erase(result.begin() + static_cast<std::ptrdiff_t>(maxCount), result.end());
 					const auto pos = static_cast<std::size_t>(result.back().data() - a_range.data());
 					result.back() = a_range.subspan(pos);
 				}
@@ -100,6 +143,537 @@ namespace bsa::fo4
 
 				return slice;
 			}
+
+			[[nodiscard]] auto directx_mip_size(
+				const fo4::file::header_t& a_header,
+				std::size_t a_mip)
+				-> std::size_t
+			{
+				return directx_mip_chunk_maximum(
+					static_cast<::DXGI_FORMAT>(a_header.format),
+					(std::max)(std::size_t{ a_header.width } >> a_mip, std::size_t{ 1 }),
+					(std::max)(std::size_t{ a_header.height } >> a_mip, std::size_t{ 1 }));
+			}
+
+			[[nodiscard]] auto align_chunk(
+				std::uint64_t a_offset,
+				std::size_t a_size,
+				const fo4::write_options& a_options) noexcept
+				-> std::uint64_t
+			{
+				if (a_size < a_options.alignment_threshold) {
+					return a_offset;
+				} else {
+					return align_up(static_cast<std::size_t>(a_offset), a_options.alignment);
+				}
+			}
+
+			struct dds_t final
+			{
+				std::size_t width{ 0 };
+				std::size_t height{ 0 };
+				std::size_t mip_count{ 0 };
+				::DXGI_FORMAT format{ DXGI_FORMAT_UNKNOWN };
+				bool cubemap{ false };
+				std::vector<DirectX::Image> images;  // faces, then mips, in the order they are stored
+			};
+
+			[[nodiscard]] auto legacy_dds_format(
+				std::uint32_t a_flags,
+				std::uint32_t a_fourCC,
+				std::uint32_t a_bitCount,
+				std::array<std::uint32_t, 4> a_masks) noexcept
+				-> ::DXGI_FORMAT
+			{
+				using masks_t = std::array<std::uint32_t, 4>;
+
+				if ((a_flags & constants::ddpf_fourcc) != 0) {
+					switch (a_fourCC) {
+					case make_four_cc("DXT1"sv):
+						return DXGI_FORMAT_BC1_UNORM;
+					case make_four_cc("DXT2"sv):
+					case make_four_cc("DXT3"sv):
+						return DXGI_FORMAT_BC2_UNORM;
+					case make_four_cc("DXT4"sv):
+					case make_four_cc("DXT5"sv):
+						return DXGI_FORMAT_BC3_UNORM;
+					case make_four_cc("ATI1"sv):
+					case make_four_cc("BC4U"sv):
+						return DXGI_FORMAT_BC4_UNORM;
+					case make_four_cc("BC4S"sv):
+						return DXGI_FORMAT_BC4_SNORM;
+					case make_four_cc("ATI2"sv):
+					case make_four_cc("BC5U"sv):
+						return DXGI_FORMAT_BC5_UNORM;
+					case make_four_cc("BC5S"sv):
+						return DXGI_FORMAT_BC5_SNORM;
+					default:
+						return DXGI_FORMAT_UNKNOWN;
+					}
+				} else if ((a_flags & constants::ddpf_rgb) != 0) {
+					switch (a_bitCount) {
+					case 32:
+						if (a_masks == masks_t{ 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 }) {
+							return DXGI_FORMAT_B8G8R8A8_UNORM;
+						} else if (a_masks == masks_t{ 0x00FF0000, 0x0000FF00, 0x000000FF, 0 }) {
+							return DXGI_FORMAT_B8G8R8X8_UNORM;
+						} else if (a_masks == masks_t{ 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 }) {
+							return DXGI_FORMAT_R8G8B8A8_UNORM;
+						} else {
+							return DXGI_FORMAT_UNKNOWN;
+						}
+					case 16:
+						if (a_masks == masks_t{ 0xF800, 0x07E0, 0x001F, 0 }) {
+							return DXGI_FORMAT_B5G6R5_UNORM;
+						} else if (a_masks == masks_t{ 0x7C00, 0x03E0, 0x001F, 0x8000 }) {
+							return DXGI_FORMAT_B5G5R5A1_UNORM;
+						} else if (a_masks == masks_t{ 0x0F00, 0x00F0, 0x000F, 0xF000 }) {
+							return DXGI_FORMAT_B4G4R4A4_UNORM;
+						} else {
+							return DXGI_FORMAT_UNKNOWN;
+						}
+					default:
+						return DXGI_FORMAT_UNKNOWN;
+					}
+				} else if ((a_flags & constants::ddpf_luminance) != 0) {
+					return a_bitCount == 8 && a_masks[0] == 0xFF ?
+						DXGI_FORMAT_R8_UNORM :
+						DXGI_FORMAT_UNKNOWN;
+				} else if ((a_flags & constants::ddpf_alpha) != 0) {
+					return a_bitCount == 8 && a_masks[3] == 0xFF ?
+						DXGI_FORMAT_A8_UNORM :
+						DXGI_FORMAT_UNKNOWN;
+				} else {
+					return DXGI_FORMAT_UNKNOWN;
+				}
+			}
+
+			// parses the dds header directly, so that the images can refer to the source bytes,
+			//	rather than to a copy of them. anything which would need converting (volume textures,
+			//	texture arrays, or legacy formats with no direct dxgi equivalent) is left to dxtex
+			[[nodiscard]] auto parse_dds(istream_t& a_in)
+				-> std::optional<dds_t>
+			{
+				const auto src = a_in->rdbuf();
+				if (src.size() < constants::dds_header_size) {
+					return std::nullopt;
+				}
+
+				const restore_point _{ a_in };
+				a_in->seek_absolute(0);
+
+				const auto [magic, size, flags, height, width, pitch, depth, mipCount] =
+					a_in->read<
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t>();
+				a_in->seek_relative(11u * 4u);  // skip reserved
+				const auto [pfSize, pfFlags, fourCC, bitCount, r, g, b, a] =
+					a_in->read<
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t,
+						std::uint32_t>();
+				const auto [caps, caps2] = a_in->read<std::uint32_t, std::uint32_t>();
+
+				if (magic != constants::dds ||
+					(caps2 & constants::ddscaps2_volume) != 0 ||
+					((flags & constants::ddsd_depth) != 0 && depth > 1)) {
+					return std::nullopt;
+				}
+
+				dds_t result;
+				result.width = width;
+				result.height = height;
+				result.mip_count =
+					(flags & constants::ddsd_mipmapcount) != 0 ?
+						(std::max)(mipCount, 1u) :
+						1u;
+
+				// like dxtex, reject more mips than the largest dimension can be halved into
+				if (result.mip_count > static_cast<std::size_t>(std::bit_width((std::max)({ width, height, 1u })))) {
+					return std::nullopt;
+				}
+
+				std::size_t offset = constants::dds_header_size;
+				if ((pfFlags & constants::ddpf_fourcc) != 0 && fourCC == constants::dx10) {
+					if (src.size() < offset + constants::dx10_header_size) {
+						return std::nullopt;
+					}
+
+					a_in->seek_absolute(offset);
+					const auto [format, dimension, miscFlag, arraySize] =
+						a_in->read<std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t>();
+					if (dimension != constants::resource_dimension_texture2d || arraySize != 1) {
+						return std::nullopt;
+					}
+
+					result.format = static_cast<::DXGI_FORMAT>(format);
+					result.cubemap = (miscFlag & constants::resource_misc_texturecube) != 0;
+					offset += constants::dx10_header_size;
+				} else {
+					if ((caps2 & constants::ddscaps2_cubemap) != 0) {
+						if ((caps2 & constants::ddscaps2_cubemap_allfaces) !=
+							constants::ddscaps2_cubemap_allfaces) {
+							return std::nullopt;
+						}
+						result.cubemap = true;
+					}
+
+					result.format = legacy_dds_format(pfFlags, fourCC, bitCount, { r, g, b, a });
+				}
+
+				if (result.format == DXGI_FORMAT_UNKNOWN) {
+					return std::nullopt;
+				}
+
+				const auto faces = result.cubemap ? 6u : 1u;
+				result.images.reserve(faces * result.mip_count);
+				for (std::size_t face = 0; face < faces; ++face) {
+					for (std::size_t mip = 0; mip < result.mip_count; ++mip) {
+						auto& image = result.images.emplace_back();
+						image.width = (std::max)(result.width >> mip, std::size_t{ 1 });
+						image.height = (std::max)(result.height >> mip, std::size_t{ 1 });
+						image.format = result.format;
+						if (const auto hr = DirectX::ComputePitch(
+								image.format,
+								image.width,
+								image.height,
+								image.rowPitch,
+								image.slicePitch);
+							FAILED(hr) || src.size() - offset < image.slicePitch) {
+							return std::nullopt;
+						}
+
+						// dxtex exposes mutable pixels, but they are only ever read from
+						image.pixels = reinterpret_cast<std::uint8_t*>(
+							const_cast<std::byte*>(src.data() + offset));
+						offset += image.slicePitch;
+					}
+				}
+
+				return result;
+			}
+
+			struct dds_pixel_format_t final
+			{
+				std::uint32_t flags{ 0 };
+				std::uint32_t fourCC{ 0 };
+				std::uint32_t bitCount{ 0 };
+				std::array<std::uint32_t, 4> masks{};
+			};
+
+			// the inverse of `legacy_dds_format`, matching the choices EncodeDDSHeader makes
+			[[nodiscard]] auto legacy_dds_pixel_format(::DXGI_FORMAT a_format) noexcept
+				-> std::optional<dds_pixel_format_t>
+			{
+				const auto fourCC = [](std::uint32_t a_fourCC) {
+					return dds_pixel_format_t{ constants::ddpf_fourcc, a_fourCC };
+				};
+				const auto rgb = [](std::uint32_t a_flags, std::uint32_t a_bitCount, std::array<std::uint32_t, 4> a_masks) {
+					return dds_pixel_format_t{ a_flags, 0, a_bitCount, a_masks };
+				};
+				constexpr auto rgba = constants::ddpf_rgb | constants::ddpf_alphapixels;
+
+				switch (a_format) {
+				case DXGI_FORMAT_R8G8B8A8_UNORM:
+					return rgb(rgba, 32, { 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 });
+				case DXGI_FORMAT_R16G16_UNORM:
+					return rgb(constants::ddpf_rgb, 32, { 0x0000FFFF, 0xFFFF0000, 0, 0 });
+				case DXGI_FORMAT_R8G8_UNORM:
+					return rgb(constants::ddpf_luminance | constants::ddpf_alphapixels, 16, { 0x00FF, 0, 0, 0xFF00 });
+				case DXGI_FORMAT_R16_UNORM:
+					return rgb(constants::ddpf_luminance, 16, { 0xFFFF, 0, 0, 0 });
+				case DXGI_FORMAT_R8_UNORM:
+					return rgb(constants::ddpf_luminance, 8, { 0xFF, 0, 0, 0 });
+				case DXGI_FORMAT_A8_UNORM:
+					return rgb(constants::ddpf_alpha, 8, { 0, 0, 0, 0xFF });
+				case DXGI_FORMAT_BC1_UNORM:
+					return fourCC(make_four_cc("DXT1"sv));
+				case DXGI_FORMAT_BC2_UNORM:
+					return fourCC(make_four_cc("DXT3"sv));
+				case DXGI_FORMAT_BC3_UNORM:
+					return fourCC(make_four_cc("DXT5"sv));
+				case DXGI_FORMAT_BC4_UNORM:
+					return fourCC(make_four_cc("BC4U"sv));
+				case DXGI_FORMAT_BC4_SNORM:
+					return fourCC(make_four_cc("BC4S"sv));
+				case DXGI_FORMAT_BC5_UNORM:
+					return fourCC(make_four_cc("BC5U"sv));
+				case DXGI_FORMAT_BC5_SNORM:
+					return fourCC(make_four_cc("BC5S"sv));
+				case DXGI_FORMAT_B5G6R5_UNORM:
+					return rgb(constants::ddpf_rgb, 16, { 0xF800, 0x07E0, 0x001F, 0 });
+				case DXGI_FORMAT_B5G5R5A1_UNORM:
+					return rgb(rgba, 16, { 0x7C00, 0x03E0, 0x001F, 0x8000 });
+				case DXGI_FORMAT_B8G8R8A8_UNORM:
+					return rgb(rgba, 32, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 });
+				case DXGI_FORMAT_B8G8R8X8_UNORM:
+					return rgb(constants::ddpf_rgb, 32, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0 });
+				case DXGI_FORMAT_B4G4R4A4_UNORM:
+					return rgb(rgba, 16, { 0x0F00, 0x00F0, 0x000F, 0xF000 });
+				case DXGI_FORMAT_R8G8_SNORM:
+					return rgb(constants::ddpf_bumpdudv, 16, { 0x00FF, 0xFF00, 0, 0 });
+				case DXGI_FORMAT_R8G8B8A8_SNORM:
+					return rgb(constants::ddpf_bumpdudv, 32, { 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 });
+				case DXGI_FORMAT_R16G16_SNORM:
+					return rgb(constants::ddpf_bumpdudv, 32, { 0x0000FFFF, 0xFFFF0000, 0, 0 });
+				case DXGI_FORMAT_R8G8_B8G8_UNORM:
+					return fourCC(make_four_cc("RGBG"sv));
+				case DXGI_FORMAT_G8R8_G8B8_UNORM:
+					return fourCC(make_four_cc("GRGB"sv));
+				case DXGI_FORMAT_YUY2:
+					return fourCC(make_four_cc("YUY2"sv));
+				// legacy d3dx formats use their D3DFMT value as the four cc
+				case DXGI_FORMAT_R32G32B32A32_FLOAT:
+					return fourCC(116);
+				case DXGI_FORMAT_R16G16B16A16_FLOAT:
+					return fourCC(113);
+				case DXGI_FORMAT_R16G16B16A16_UNORM:
+					return fourCC(36);
+				case DXGI_FORMAT_R16G16B16A16_SNORM:
+					return fourCC(110);
+				case DXGI_FORMAT_R32G32_FLOAT:
+					return fourCC(115);
+				case DXGI_FORMAT_R16G16_FLOAT:
+					return fourCC(112);
+				case DXGI_FORMAT_R32_FLOAT:
+					return fourCC(114);
+				case DXGI_FORMAT_R16_FLOAT:
+					return fourCC(111);
+				default:
+					return std::nullopt;
+				}
+			}
+
+			// a dds header (including the magic and any dx10 extension) built in place, producing
+			//	the same bytes as DirectXTex's EncodeDDSHeader without going through a blob, given
+			//	the metadata DirectXTex itself loads the texture with (i.e. six faces for a cubemap)
+			class dds_header_t final
+			{
+			public:
+				explicit dds_header_t(const fo4::file::header_t& a_header)
+				{
+					const auto format = static_cast<::DXGI_FORMAT>(a_header.format);
+					const bool cubemap = (a_header.flags & 1u) != 0;
+
+					std::size_t rowPitch = 0;
+					std::size_t slicePitch = 0;
+					if (const auto hr = DirectX::ComputePitch(format, a_header.width, a_header.height, rowPitch, slicePitch);
+						FAILED(hr) || rowPitch > (std::numeric_limits<std::uint32_t>::max)() || slicePitch > (std::numeric_limits<std::uint32_t>::max)()) {
+						throw bsa::exception("failed to encode dds header");
+					}
+					const bool compressed = DirectX::IsCompressed(format);
+
+					auto flags = constants::ddsd_texture;
+					if (a_header.mip_count > 0) {
+						flags |= constants::ddsd_mipmapcount;
+					}
+					flags |= compressed ? constants::ddsd_linearsize : constants::ddsd_pitch;
+					auto caps = constants::ddscaps_texture;
+					if (a_header.mip_count > 1) {
+						caps |= constants::ddscaps_mipmap | constants::ddscaps_complex;
+					}
+					if (cubemap) {
+						caps |= constants::ddscaps_complex;
+					}
+
+					this->put(constants::dds);
+					this->put(static_cast<std::uint32_t>(constants::dds_header_size - 4));
+					this->put(flags);
+					this->put(a_header.height);
+					this->put(a_header.width);
+					this->put(static_cast<std::uint32_t>(compressed ? slicePitch : rowPitch));
+					this->put(1u);  // depth
+					this->put(a_header.mip_count);
+					_size += 11 * 4;  // reserved
+
+					const auto legacy = legacy_dds_pixel_format(format);
+					const auto pf = legacy ? *legacy : dds_pixel_format_t{ constants::ddpf_fourcc, constants::dx10 };
+					this->put(32u);
+					this->put(pf.flags);
+					this->put(pf.fourCC);
+					this->put(pf.bitCount);
+					for (const auto mask : pf.masks) {
+						this->put(mask);
+					}
+
+					this->put(caps);
+					this->put(cubemap ? constants::ddscaps2_cubemap | constants::ddscaps2_cubemap_allfaces : 0u);
+					_size += 3 * 4;  // caps3, caps4, reserved
+					assert(_size == constants::dds_header_size);
+
+					if (!legacy) {
+						this->put(a_header.format);
+						this->put(constants::resource_dimension_texture2d);
+						this->put(cubemap ? constants::resource_misc_texturecube : 0u);
+						this->put(1u);  // array size
+						this->put(0u);  // misc flags 2
+						assert(_size == _buffer.size());
+					}
+				}
+
+				[[nodiscard]] auto as_bytes() const noexcept
+					-> std::span<const std::byte> { return { _buffer.data(), _size }; }
+
+			private:
+				void put(std::uint32_t a_value) noexcept
+				{
+					for (std::size_t i = 0; i < 4; ++i) {
+						_buffer[_size++] = static_cast<std::byte>(a_value >> (i * 8));
+					}
+				}
+
+				std::array<std::byte, constants::dds_header_size + constants::dx10_header_size> _buffer{};
+				std::size_t _size{ 0 };
+			};
+
+			void write_directx_header(
+				ostream_t& a_out,
+				const fo4::file::header_t& a_header)
+			{
+				a_out.write_bytes(dds_header_t{ a_header }.as_bytes());
+			}
+
+			// checks that a compressed chunk is framed the way the archive claims without decoding
+			//	it: zlib streams must open with a valid header, while lz4 blocks must parse into
+			//	sequences which decode to exactly the decompressed size
+			[[nodiscard]] bool framed_as(
+				const fo4::chunk& a_chunk,
+				compression_format a_compression) noexcept
+			{
+				const auto in = a_chunk.as_bytes();
+				const auto byte = [&](std::size_t a_pos) noexcept {
+					return static_cast<std::size_t>(in[a_pos]);
+				};
+
+				if (a_compression == compression_format::zip) {
+					return in.size() >= 2 &&
+					       (byte(0) & 0x0F) == 8 &&  // deflate
+					       (byte(0) >> 4) <= 7 &&    // window size
+					       ((byte(0) << 8) | byte(1)) % 31 == 0;
+				}
+
+				std::size_t pos = 0;
+				std::size_t out = 0;
+				const auto length = [&](std::size_t a_base) noexcept -> std::optional<std::size_t> {
+					auto len = a_base;
+					if (a_base == 0xF) {
+						std::size_t next = 0;
+						do {
+							if (pos == in.size()) {
+								return std::nullopt;
+							}
+							next = byte(pos++);
+							len += next;
+						} while (next == 0xFF);
+					}
+					return len;
+				};
+
+				while (pos < in.size()) {
+					const auto token = byte(pos++);
+					const auto literals = length(token >> 4);
+					if (!literals || *literals > in.size() - pos) {
+						return false;
+					}
+					pos += *literals;
+					out += *literals;
+					if (pos == in.size()) {
+						break;  // the last sequence has no match
+					}
+
+					if (in.size() - pos < 2) {
+						return false;
+					}
+					const auto offset = byte(pos) | byte(pos + 1) << 8;
+					pos += 2;
+					const auto match = length(token & 0xF);
+					if (offset == 0 || offset > out || !match) {
+						return false;
+					}
+					out += *match + 4;
+				}
+
+				return out == a_chunk.decompressed_size();
+			}
+
+			void verify_compression(
+				const fo4::chunk& a_chunk,
+				compression_format a_compression)
+			{
+				if (a_chunk.compressed() && !framed_as(a_chunk, a_compression)) {
+					throw bsa::exception("chunk is not compressed with the archive's format");
+				}
+			}
+
+			// writes the decompressed contents of the chunk, dropping the first `a_skip` bytes
+			//	of every `a_stride` bytes, where `a_pos` is the position of the chunk within
+			//	the strided data, and is advanced past it
+			// `a_buffer` is shared by every chunk of a file, as lz4 blocks must be decoded whole
+			void write_decompressed(
+				ostream_t& a_out,
+				const fo4::chunk& a_chunk,
+				compression_format a_compression,
+				scratch_buffer& a_buffer,
+				std::size_t a_skip,
+				std::size_t a_stride,
+				std::size_t& a_pos)
+			{
+				auto& pos = a_pos;
+				const auto write = [&](std::span<const std::byte> a_bytes) {
+					while (!a_bytes.empty()) {
+						const auto offset = pos % a_stride;
+						const auto len = (std::min)(a_bytes.size(), a_stride - offset);
+						if (offset + len > a_skip) {
+							const auto drop = offset < a_skip ? a_skip - offset : 0;
+							a_out.write_bytes(a_bytes.subspan(drop, len - drop));
+						}
+						pos += len;
+						a_bytes = a_bytes.subspan(len);
+					}
+					return true;
+				};
+
+				if (!a_chunk.compressed()) {
+					write(a_chunk.as_bytes());
+				} else if (a_compression == compression_format::lz4) {
+					// lz4 blocks can't be decoded incrementally
+					write(a_chunk.extract(a_buffer, a_compression));
+				} else {
+					const auto written = inflate_stream(a_chunk.as_bytes(), write);
+					if (written != a_chunk.decompressed_size()) {
+						throw bsa::compression_error(error_code::decompress_size_mismatch);
+					}
+				}
+			}
+
+			void write_decompressed(
+				ostream_t& a_out,
+				const fo4::chunk& a_chunk,
+				compression_format a_compression,
+				scratch_buffer& a_buffer,
+				std::size_t a_skip = 0)
+			{
+				std::size_t pos = 0;
+				write_decompressed(
+					a_out,
+					a_chunk,
+					a_compression,
+					a_buffer,
+					a_skip,
+					(std::numeric_limits<std::size_t>::max)(),
+					pos);
+			}
 		}
 
 		class header_t final
@@ -109,12 +683,20 @@ namespace bsa::fo4
 
 			header_t(
 				format a_format,
+				version a_version,
+				compression_format a_compression,
 				std::size_t a_fileCount,
-				std::uint64_t a_stringTableOffset) noexcept :
+				std::uint64_t a_stringTableOffset) :
+				_version(to_underlying(a_version)),
 				_format(to_underlying(a_format)),
 				_fileCount(static_cast<std::uint32_t>(a_fileCount)),
-				_stringTableOffset(a_stringTableOffset)
-			{}
+				_stringTableOffset(a_stringTableOffset),
+				_compression(to_underlying(a_compression))
+			{
+				if (a_compression != compression_format::zip && a_version != version::v3) {
+					throw exception("compression format is not supported by the archive version");
+				}
+			}
 
 			friend auto operator>>(
 				istream_t& a_in,
@@ -122,24 +704,37 @@ namespace bsa::fo4
 				-> istream_t&
 			{
 				std::uint32_t magic = 0;
-				std::uint32_t version = 0;
 
 				a_in->read(
 					magic,
-					version,
+					a_header._version,
 					a_header._format,
 					a_header._fileCount,
 					a_header._stringTableOffset);
 
 				if (magic != constants::btdx) {
 					throw exception("invalid magic");
-				} else if (version != 1) {
+				} else if (a_header._version < to_underlying(version::v1) ||
+						   a_header._version > to_underlying(version::v3)) {
 					throw exception("invalid version");
 				} else if (a_header._format != constants::gnrl &&
 						   a_header._format != constants::dx10) {
 					throw exception("invalid format");
 				}
 
+				if (a_header._version >= to_underlying(version::v2)) {
+					[[maybe_unused]] std::uint64_t unknown = 0;
+					a_in->read(unknown);
+				}
+
+				if (a_header._version >= to_underlying(version::v3)) {
+					a_in->read(a_header._compression);
+					if (a_header._compression != to_underlying(compression_format::zip) &&
+						a_header._compression != to_underlying(compression_format::lz4)) {
+						throw exception("invalid compression format");
+					}
+				}
+
 				return a_in;
 			}
 
@@ -150,22 +745,52 @@ namespace bsa::fo4
 			{
 				a_out.write(
 					constants::btdx,
-					std::uint32_t{ 1 },
+					a_header._version,
 					a_header._format,
 					a_header._fileCount,
 					a_header._stringTableOffset);
+
+				if (a_header._version >= to_underlying(version::v2)) {
+					a_out.write(std::uint64_t{ 1 });
+				}
+
+				if (a_header._version >= to_underlying(version::v3)) {
+					a_out.write(a_header._compression);
+				}
+
 				return a_out;
 			}
 
 			[[nodiscard]] auto archive_format() const noexcept -> std::size_t { return _format; }
+			[[nodiscard]] auto archive_version() const noexcept
+				-> version { return static_cast<version>(_version); }
+			[[nodiscard]] auto compression() const noexcept
+				-> compression_format { return static_cast<compression_format>(_compression); }
 			[[nodiscard]] auto file_count() const noexcept -> std::size_t { return _fileCount; }
 			[[nodiscard]] auto string_table_offset() const noexcept
 				-> std::uint64_t { return _stringTableOffset; }
 
+			[[nodiscard]] static auto size(version a_version) noexcept
+				-> std::size_t
+			{
+				switch (a_version) {
+				case version::v1:
+					return constants::header_size_v1;
+				case version::v2:
+					return constants::header_size_v2;
+				case version::v3:
+					return constants::header_size_v3;
+				default:
+					declare_unreachable();
+				}
+			}
+
 		private:
+			std::uint32_t _version{ 0 };
 			std::uint32_t _format{ 0 };
 			std::uint32_t _fileCount{ 0 };
 			std::uint64_t _stringTableOffset{ 0 };
+			std::uint32_t _compression{ 0 };
 		};
 	}
 
@@ -295,12 +920,18 @@ namespace bsa::fo4
 		}
 	}
 
-	std::size_t chunk::compress_into_default(std::span<std::byte> a_out) const
+	std::size_t chunk::compress_into_default(
+		std::span<std::byte> a_out,
+		execution_policy a_policy) const
 	{
 		assert(!this->compressed());
 		assert(a_out.size_bytes() >= this->compress_bound());
 
 		const auto in = this->as_bytes();
+		if (const auto outsz = detail::deflate_parallel(in, a_out, Z_DEFAULT_COMPRESSION, MAX_WBITS, a_policy); outsz) {
+			return *outsz;
+		}
+
 		auto outsz = static_cast<::uLong>(a_out.size());
 
 		const auto result = ::compress(
@@ -315,11 +946,17 @@ namespace bsa::fo4
 		return static_cast<std::size_t>(outsz);
 	}
 
-	std::size_t chunk::compress_into_xbox(std::span<std::byte> a_out) const
+	std::size_t chunk::compress_into_xbox(
+		std::span<std::byte> a_out,
+		execution_policy a_policy) const
 	{
 		assert(!this->compressed());
 		assert(a_out.size_bytes() >= this->compress_bound());
 
+		if (const auto outsz = detail::deflate_parallel(this->as_bytes(), a_out, Z_BEST_COMPRESSION, 12, a_policy); outsz) {
+			return *outsz;
+		}
+
 		::z_stream stream = {};
 		if (const auto result = deflateInit2(
 				&stream,
@@ -368,6 +1005,68 @@ namespace bsa::fo4
 		return finalsz;
 	}
 
+	std::size_t chunk::compress_into_lz4(
+		std::span<std::byte> a_out,
+		compression_level a_level) const
+	{
+		assert(!this->compressed());
+		assert(a_out.size_bytes() >= this->compress_bound(compression_format::lz4));
+
+		const auto in = this->as_bytes();
+		const auto result =
+			a_level == compression_level::xbox ?
+				::LZ4_compress_HC(
+					reinterpret_cast<const char*>(in.data()),
+					reinterpret_cast<char*>(a_out.data()),
+					static_cast<int>(in.size_bytes()),
+					static_cast<int>(a_out.size_bytes()),
+					LZ4HC_CLEVEL_MAX) :
+				::LZ4_compress_default(
+					reinterpret_cast<const char*>(in.data()),
+					reinterpret_cast<char*>(a_out.data()),
+					static_cast<int>(in.size_bytes()),
+					static_cast<int>(a_out.size_bytes()));
+		if (result <= 0 && !in.empty()) {
+			throw bsa::compression_error(detail::error_code::lz4_block_compress_failure);
+		}
+
+		return static_cast<std::size_t>(result);
+	}
+
+	void chunk::decompress_into_lz4(std::span<std::byte> a_out) const
+	{
+		const auto in = this->as_bytes();
+		const auto result = ::LZ4_decompress_safe(
+			reinterpret_cast<const char*>(in.data()),
+			reinterpret_cast<char*>(a_out.data()),
+			static_cast<int>(in.size_bytes()),
+			static_cast<int>(this->decompressed_size()));
+		if (result < 0) {
+			throw bsa::compression_error(detail::error_code::lz4_block_decompress_failure);
+		} else if (static_cast<std::size_t>(result) != this->decompressed_size()) {
+			throw bsa::compression_error(detail::error_code::decompress_size_mismatch);
+		}
+	}
+
+	void chunk::decompress_into_zip(std::span<std::byte> a_out) const
+	{
+		const auto in = this->as_bytes();
+		auto outsz = static_cast<::uLong>(a_out.size_bytes());
+
+		const auto result = ::uncompress(
+			reinterpret_cast<::Byte*>(a_out.data()),
+			&outsz,
+			reinterpret_cast<const ::Byte*>(in.data()),
+			static_cast<::uLong>(in.size_bytes()));
+		if (result != Z_OK) {
+			throw bsa::compression_error(bsa::compression_error::library::zlib, result);
+		}
+
+		if (outsz != this->decompressed_size()) {
+			throw bsa::compression_error(detail::error_code::decompress_size_mismatch);
+		}
+	}
+
 	auto operator>>(
 		detail::istream_t& a_in,
 		chunk::mips_t& a_mips)
@@ -387,12 +1086,29 @@ namespace bsa::fo4
 	}
 
 	void chunk::compress(
-		compression_level a_level)
+		compression_level a_level,
+		execution_policy a_policy)
 	{
 		std::vector<std::byte> out;
 		out.resize(this->compress_bound());
 
-		const auto outsz = this->compress_into({ out.data(), out.size() }, a_level);
+		const auto outsz = this->compress_into({ out.data(), out.size() }, a_level, a_policy);
+		out.resize(outsz);
+		out.shrink_to_fit();
+		this->set_data(std::move(out), this->size());
+
+		assert(this->compressed());
+	}
+
+	void chunk::compress(
+		compression_format a_compressionFormat,
+		compression_level a_level,
+		execution_policy a_policy)
+	{
+		std::vector<std::byte> out;
+		out.resize(this->compress_bound(a_compressionFormat));
+
+		const auto outsz = this->compress_into({ out.data(), out.size() }, a_compressionFormat, a_level, a_policy);
 		out.resize(outsz);
 		out.shrink_to_fit();
 		this->set_data(std::move(out), this->size());
@@ -400,57 +1116,93 @@ namespace bsa::fo4
 		assert(this->compressed());
 	}
 
-	auto chunk::compress_bound() const
+	auto chunk::compress_bound(compression_format a_compressionFormat) const
 		-> std::size_t
 	{
 		assert(!this->compressed());
-		return ::compressBound(static_cast<::uLong>(this->size()));
+		switch (a_compressionFormat) {
+		case compression_format::zip:
+			return ::compressBound(static_cast<::uLong>(this->size()));
+		case compression_format::lz4:
+			return static_cast<std::size_t>(::LZ4_compressBound(static_cast<int>(this->size())));
+		default:
+			detail::declare_unreachable();
+		}
 	}
 
 	auto chunk::compress_into(
 		std::span<std::byte> a_out,
-		compression_level a_level) const
+		compression_level a_level,
+		execution_policy a_policy) const
 		-> std::size_t
 	{
 		switch (a_level) {
 		case compression_level::normal:
-			return this->compress_into_default(a_out);
+			return this->compress_into_default(a_out, a_policy);
 		case compression_level::xbox:
-			return this->compress_into_xbox(a_out);
+			return this->compress_into_xbox(a_out, a_policy);
+		default:
+			detail::declare_unreachable();
+		}
+	}
+
+	auto chunk::compress_into(
+		std::span<std::byte> a_out,
+		compression_format a_compressionFormat,
+		compression_level a_level,
+		execution_policy a_policy) const
+		-> std::size_t
+	{
+		switch (a_compressionFormat) {
+		case compression_format::zip:
+			return this->compress_into(a_out, a_level, a_policy);
+		case compression_format::lz4:
+			return this->compress_into_lz4(a_out, a_level);
 		default:
 			detail::declare_unreachable();
 		}
 	}
 
-	void chunk::decompress()
+	void chunk::decompress(compression_format a_compressionFormat)
 	{
 		std::vector<std::byte> out;
 		out.resize(this->decompressed_size());
-		this->decompress_into({ out.data(), out.size() });
+		this->decompress_into({ out.data(), out.size() }, a_compressionFormat);
 		this->set_data(std::move(out));
 
 		assert(!this->compressed());
 	}
 
-	void chunk::decompress_into(std::span<std::byte> a_out) const
+	void chunk::decompress_into(
+		std::span<std::byte> a_out,
+		compression_format a_compressionFormat) const
 	{
 		assert(this->compressed());
 		assert(a_out.size_bytes() >= this->decompressed_size());
 
-		const auto in = this->as_bytes();
-		auto outsz = static_cast<::uLong>(a_out.size_bytes());
-
-		const auto result = ::uncompress(
-			reinterpret_cast<::Byte*>(a_out.data()),
-			&outsz,
-			reinterpret_cast<const ::Byte*>(in.data()),
-			static_cast<::uLong>(in.size_bytes()));
-		if (result != Z_OK) {
-			throw bsa::compression_error(bsa::compression_error::library::zlib, result);
+		switch (a_compressionFormat) {
+		case compression_format::zip:
+			this->decompress_into_zip(a_out);
+			break;
+		case compression_format::lz4:
+			this->decompress_into_lz4(a_out);
+			break;
+		default:
+			detail::declare_unreachable();
 		}
+	}
 
-		if (outsz != this->decompressed_size()) {
-			throw bsa::compression_error(detail::error_code::decompress_size_mismatch);
+	auto chunk::extract(
+		scratch_buffer& a_buffer,
+		compression_format a_compressionFormat) const
+		-> std::span<const std::byte>
+	{
+		if (this->compressed()) {
+			const auto out = a_buffer.acquire(this->decompressed_size());
+			this->decompress_into(out, a_compressionFormat);
+			return out;
+		} else {
+			return this->as_bytes();
 		}
 	}
 
@@ -490,10 +1242,12 @@ namespace bsa::fo4
 		std::size_t a_mipChunkWidth,
 		std::size_t a_mipChunkHeight,
 		compression_level a_level,
-		compression_type a_compression)
+		compression_type a_compression,
+		compression_format a_compressionFormat)
 	{
 		detail::istream_t in{ std::move(a_path) };
-		this->do_read(in, a_format, a_mipChunkWidth, a_mipChunkHeight, a_level, a_compression);
+		const chunk_budget budget{ .width = a_mipChunkWidth, .height = a_mipChunkHeight };
+		this->do_read(in, a_format, budget, a_level, a_compression, a_compressionFormat);
 	}
 
 	void file::read(
@@ -503,41 +1257,125 @@ namespace bsa::fo4
 		std::size_t a_mipChunkHeight,
 		compression_level a_level,
 		compression_type a_compression,
-		copy_type a_copy)
+		copy_type a_copy,
+		compression_format a_compressionFormat)
 	{
 		detail::istream_t in{ a_src, a_copy };
-		this->do_read(in, a_format, a_mipChunkWidth, a_mipChunkHeight, a_level, a_compression);
+		const chunk_budget budget{ .width = a_mipChunkWidth, .height = a_mipChunkHeight };
+		this->do_read(in, a_format, budget, a_level, a_compression, a_compressionFormat);
+	}
+
+	void file::read(
+		std::filesystem::path a_path,
+		format a_format,
+		const chunk_budget& a_budget,
+		compression_level a_level,
+		compression_type a_compression,
+		compression_format a_compressionFormat)
+	{
+		detail::istream_t in{ std::move(a_path) };
+		this->do_read(in, a_format, a_budget, a_level, a_compression, a_compressionFormat);
+	}
+
+	void file::read(
+		std::span<const std::byte> a_src,
+		format a_format,
+		const chunk_budget& a_budget,
+		compression_level a_level,
+		compression_type a_compression,
+		copy_type a_copy,
+		compression_format a_compressionFormat)
+	{
+		detail::istream_t in{ a_src, a_copy };
+		this->do_read(in, a_format, a_budget, a_level, a_compression, a_compressionFormat);
 	}
 
 	void file::write(
 		std::filesystem::path a_path,
-		format a_format) const
+		format a_format,
+		compression_format a_compressionFormat) const
 	{
-		binary_io::any_ostream out{ std::in_place_type<binary_io::file_ostream>, std::move(a_path) };
-		this->do_write(out, a_format);
+		// the size of the output is known up front, so chunks can be decompressed
+		//	directly into a mapping of the destination
+		std::optional<detail::dds_header_t> header;
+		std::size_t size = 0;
+		if (a_format == format::directx) {
+			header.emplace(this->header);
+			size += header->as_bytes().size();
+		}
+		for (const auto& chunk : *this) {
+			size += chunk.compressed() ? chunk.decompressed_size() : chunk.size();
+		}
+
+		if (size == 0) {
+			binary_io::any_ostream out{ std::in_place_type<binary_io::file_ostream>, std::move(a_path) };
+			return;
+		}
+
+		mmio::mapped_file_sink sink{ std::move(a_path), size };
+		if (!sink.is_open()) {
+			throw bsa::exception("failed to open file for writing");
+		}
+
+		std::span out{ sink.data(), sink.size() };
+		const auto append = [&](std::span<const std::byte> a_bytes) {
+			std::copy(a_bytes.begin(), a_bytes.end(), out.begin());
+			out = out.subspan(a_bytes.size());
+		};
+
+		if (header) {
+			append(header->as_bytes());
+		}
+		for (const auto& chunk : *this) {
+			if (chunk.compressed()) {
+				const auto len = chunk.decompressed_size();
+				chunk.decompress_into(out.first(len), a_compressionFormat);
+				out = out.subspan(len);
+			} else {
+				append(chunk.as_bytes());
+			}
+		}
 	}
 
 	void file::write(
 		binary_io::any_ostream& a_dst,
-		format a_format) const
+		format a_format,
+		compression_format a_compressionFormat) const
 	{
-		this->do_write(a_dst, a_format);
+		this->do_write(a_dst, a_format, a_compressionFormat);
+	}
+
+	void file::write_mips(
+		std::filesystem::path a_path,
+		std::size_t a_first,
+		compression_format a_compressionFormat) const
+	{
+		binary_io::any_ostream out{ std::in_place_type<binary_io::file_ostream>, std::move(a_path) };
+		this->write_directx_mips(out, a_first, a_compressionFormat);
+	}
+
+	void file::write_mips(
+		binary_io::any_ostream& a_dst,
+		std::size_t a_first,
+		compression_format a_compressionFormat) const
+	{
+		this->write_directx_mips(a_dst, a_first, a_compressionFormat);
 	}
 
 	void file::do_read(
 		detail::istream_t& a_in,
 		format a_format,
-		std::size_t a_mipChunkWidth,
-		std::size_t a_mipChunkHeight,
+		const chunk_budget& a_budget,
 		compression_level a_level,
-		compression_type a_compression)
+		compression_type a_compression,
+		compression_format a_compressionFormat)
 	{
 		switch (a_format) {
 		case format::general:
-			this->read_general(a_in, a_level, a_compression);
+			this->read_general(a_in, a_level, a_compression, a_compressionFormat);
 			break;
 		case format::directx:
-			this->read_directx(a_in, a_mipChunkWidth, a_mipChunkHeight, a_level, a_compression);
+			this->read_directx(a_in, a_budget, a_level, a_compression, a_compressionFormat);
 			break;
 		default:
 			detail::declare_unreachable();
@@ -546,14 +1384,15 @@ namespace bsa::fo4
 
 	void file::do_write(
 		detail::ostream_t& a_out,
-		format a_format) const
+		format a_format,
+		compression_format a_compressionFormat) const
 	{
 		switch (a_format) {
 		case format::general:
-			this->write_general(a_out);
+			this->write_general(a_out, a_compressionFormat);
 			break;
 		case format::directx:
-			this->write_directx(a_out);
+			this->write_directx(a_out, a_compressionFormat);
 			break;
 		default:
 			detail::declare_unreachable();
@@ -562,68 +1401,91 @@ namespace bsa::fo4
 
 	void file::read_directx(
 		[[maybe_unused]] detail::istream_t& a_in,
-		[[maybe_unused]] std::size_t a_mipChunkWidth,
-		[[maybe_unused]] std::size_t a_mipChunkHeight,
+		[[maybe_unused]] const chunk_budget& a_budget,
 		[[maybe_unused]] compression_level a_level,
-		[[maybe_unused]] compression_type a_compression)
+		[[maybe_unused]] compression_type a_compression,
+		[[maybe_unused]] compression_format a_compressionFormat)
 	{
 		DirectX::ScratchImage scratch;
-		const auto in = a_in->rdbuf();
-		if (const auto result = DirectX::LoadFromDDSMemory(
-				in.data(),
-				in.size_bytes(),
-				DirectX::DDS_FLAGS::DDS_FLAGS_NONE,
-				nullptr,
-				scratch);
-			FAILED(result)) {
-			throw bsa::exception("failed to load dds from memory");
+		auto dds = detail::parse_dds(a_in);
+		const bool borrowed = dds.has_value();
+		if (!dds) {
+			const auto in = a_in->rdbuf();
+			if (const auto result = DirectX::LoadFromDDSMemory(
+					in.data(),
+					in.size_bytes(),
+					DirectX::DDS_FLAGS::DDS_FLAGS_NONE,
+					nullptr,
+					scratch);
+				FAILED(result)) {
+				throw bsa::exception("failed to load dds from memory");
+			}
+
+			const auto& meta = scratch.GetMetadata();
+			dds.emplace();
+			dds->width = meta.width;
+			dds->height = meta.height;
+			dds->mip_count = meta.mipLevels;
+			dds->format = meta.format;
+			dds->cubemap = meta.IsCubemap();
+			dds->images.assign(
+				scratch.GetImages(),
+				scratch.GetImages() + scratch.GetImageCount());
 		}
 
 		this->clear();
 		this->reserve(4u);
 
-		auto& meta = scratch.GetMetadata();
-		this->header.height = static_cast<std::uint16_t>(meta.height);
-		this->header.width = static_cast<std::uint16_t>(meta.width);
-		this->header.mip_count = static_cast<std::uint8_t>(meta.mipLevels);
-		this->header.format = static_cast<std::uint8_t>(meta.format);
-		this->header.flags = meta.IsCubemap() ? 1u : 0u;
+		this->header.height = static_cast<std::uint16_t>(dds->height);
+		this->header.width = static_cast<std::uint16_t>(dds->width);
+		this->header.mip_count = static_cast<std::uint8_t>(dds->mip_count);
+		this->header.format = static_cast<std::uint8_t>(dds->format);
+		this->header.flags = dds->cubemap ? 1u : 0u;
 		this->header.tile_mode = 8u;
 
-		const std::span images{ scratch.GetImages(), scratch.GetImageCount() };
+		const std::span images{ dds->images.data(), dds->images.size() };
 		const auto addChunk = [&](std::span<const DirectX::Image> a_splice) {
 			assert(!a_splice.empty());
 
-			std::vector<std::byte> bytes;
-			for (const auto& image : a_splice) {
-				// dxtex always allocates internally, so we're forced to allocate,
-				//	even for mmapped files
-				const auto pixels = reinterpret_cast<std::byte*>(image.pixels);
-				bytes.insert(bytes.end(), pixels, pixels + image.slicePitch);
-			}
-
 			const auto mipIdx = [&](const DirectX::Image& a_image) noexcept {
 				return static_cast<std::uint16_t>(
 					(std::min<std::size_t>)(  //
-						&a_image - scratch.GetImages(),
+						&a_image - images.data(),
 						this->header.mip_count - 1u));
 			};
 
 			auto& chunk = this->emplace_back();
 			chunk.mips.first = mipIdx(a_splice.front());
 			chunk.mips.last = mipIdx(a_splice.back());
-			chunk.set_data(std::move(bytes));
+			if (borrowed) {
+				// the images of a splice are stored back-to-back in the source
+				const auto first = reinterpret_cast<const std::byte*>(a_splice.front().pixels);
+				const auto last = reinterpret_cast<const std::byte*>(a_splice.back().pixels) +
+				                  a_splice.back().slicePitch;
+				chunk.set_data({ first, last }, a_in);
+			} else {
+				std::vector<std::byte> bytes;
+				for (const auto& image : a_splice) {
+					// dxtex always allocates internally, so we're forced to copy out of it
+					const auto pixels = reinterpret_cast<std::byte*>(image.pixels);
+					bytes.insert(bytes.end(), pixels, pixels + image.slicePitch);
+				}
+				chunk.set_data(std::move(bytes));
+			}
+
 			if (a_compression == compression_type::compressed) {
-				chunk.compress(a_level);
+				chunk.compress(a_compressionFormat, a_level);
 			}
 		};
 
 		if ((this->header.flags & 1u) != 0) {  // don't chunk cubemaps
 			addChunk(images);
 		} else {
-			const auto splices = detail::chunk<4>(
-				images,
-				detail::directx_mip_chunk_maximum(meta.format, a_mipChunkWidth, a_mipChunkHeight));
+			const auto budget =
+				a_budget.size != 0 ?
+					a_budget.size :
+					detail::directx_mip_chunk_maximum(dds->format, a_budget.width, a_budget.height);
+			const auto splices = detail::chunk(images, budget, a_budget.count);
 			std::for_each(splices.begin(), splices.end(), addChunk);
 		}
 	}
@@ -631,78 +1493,334 @@ namespace bsa::fo4
 	void file::read_general(
 		detail::istream_t& a_in,
 		compression_level a_level,
-		compression_type a_compression)
+		compression_type a_compression,
+		compression_format a_compressionFormat)
 	{
 		this->clear();
 
 		auto& chunk = this->emplace_back();
 		chunk.set_data(a_in->rdbuf(), a_in);
 		if (a_compression == compression_type::compressed) {
-			chunk.compress(a_level);
+			chunk.compress(a_compressionFormat, a_level);
 		}
 	}
 
 	void file::write_directx(
-		[[maybe_unused]] detail::ostream_t& a_out) const
-	{
-		const DirectX::TexMetadata meta{
-			.width = this->header.width,
-			.height = this->header.height,
-			.depth = 1,
-			.arraySize = 1,
-			.mipLevels = this->header.mip_count,
-			.miscFlags = (this->header.flags & 1u) != 0 ? std::uint32_t{ DirectX::TEX_MISC_FLAG::TEX_MISC_TEXTURECUBE } : 0u,
-			.miscFlags2 = 0,
-			.format = static_cast<::DXGI_FORMAT>(this->header.format),
-			.dimension = DirectX::TEX_DIMENSION_TEXTURE2D,
-		};
+		detail::ostream_t& a_out,
+		compression_format a_compressionFormat) const
+	{
+		detail::write_directx_header(a_out, this->header);
+		scratch_buffer buffer;
+		for (const auto& chunk : *this) {
+			detail::write_decompressed(a_out, chunk, a_compressionFormat, buffer);
+		}
+	}
 
-		std::size_t required = 0;
-		if (const auto result = DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, nullptr, 0, required);
-			FAILED(result)) {
-			throw bsa::exception("failed to encode dds header");
+	void file::write_directx_mips(
+		detail::ostream_t& a_out,
+		std::size_t a_first,
+		compression_format a_compressionFormat) const
+	{
+		if (a_first >= this->header.mip_count) {
+			throw bsa::exception("mip index is out of range");
 		}
 
-		DirectX::Blob blob;
-		blob.Initialize(required);
+		auto header = this->header;
+		header.width = static_cast<std::uint16_t>((std::max)(header.width >> a_first, 1));
+		header.height = static_cast<std::uint16_t>((std::max)(header.height >> a_first, 1));
+		header.mip_count = static_cast<std::uint8_t>(header.mip_count - a_first);
+		detail::write_directx_header(a_out, header);
+
+		scratch_buffer buffer;
+		const auto skipped = [&](std::size_t a_from) {
+			std::size_t result = 0;
+			for (std::size_t i = a_from; i < a_first; ++i) {
+				result += detail::directx_mip_size(this->header, i);
+			}
+			return result;
+		};
+
+		if ((this->header.flags & 1u) != 0) {
+			// cubemaps store each face with its full mip chain, one after another
+			const auto skip = skipped(0);
+			std::size_t stride = skip;
+			for (std::size_t i = a_first; i < this->header.mip_count; ++i) {
+				stride += detail::directx_mip_size(this->header, i);
+			}
 
-		if (const auto result = DirectX::EncodeDDSHeader(
-				meta,
-				DirectX::DDS_FLAGS::DDS_FLAGS_NONE,
-				blob.GetBufferPointer(),
-				blob.GetBufferSize(),
-				required);
-			FAILED(result)) {
-			throw bsa::exception("failed to encode dds header");
+			// a face may straddle chunks, so the position carries across them
+			std::size_t pos = 0;
+			for (const auto& chunk : *this) {
+				detail::write_decompressed(a_out, chunk, a_compressionFormat, buffer, skip, stride, pos);
+			}
+		} else {
+			for (const auto& chunk : *this) {
+				if (chunk.mips.last < a_first) {
+					continue;
+				} else if (chunk.mips.first >= a_first) {
+					detail::write_decompressed(a_out, chunk, a_compressionFormat, buffer);
+				} else {
+					detail::write_decompressed(a_out, chunk, a_compressionFormat, buffer, skipped(chunk.mips.first));
+				}
+			}
 		}
+	}
 
-		a_out.write_bytes({ //
-			reinterpret_cast<const std::byte*>(blob.GetBufferPointer()),
-			blob.GetBufferSize() });
-		std::vector<std::byte> buffer;
+	void file::write_general(
+		detail::ostream_t& a_out,
+		compression_format a_compressionFormat) const
+	{
+		scratch_buffer buffer;
 		for (const auto& chunk : *this) {
-			if (chunk.compressed()) {
-				buffer.resize(chunk.decompressed_size());
-				chunk.decompress_into(buffer);
-				a_out.write_bytes(buffer);
-			} else {
-				a_out.write_bytes(chunk.as_bytes());
+			detail::write_decompressed(a_out, chunk, a_compressionFormat, buffer);
+		}
+	}
+
+	auto read_files(
+		std::span<const std::filesystem::path> a_paths,
+		format a_format,
+		std::size_t a_mipChunkWidth,
+		std::size_t a_mipChunkHeight,
+		compression_level a_level,
+		compression_type a_compression,
+		execution_policy a_policy,
+		compression_format a_compressionFormat)
+		-> std::vector<file>
+	{
+		const chunk_budget budget{ .width = a_mipChunkWidth, .height = a_mipChunkHeight };
+		return read_files(a_paths, a_format, budget, a_level, a_compression, a_policy, a_compressionFormat);
+	}
+
+	auto read_files(
+		std::span<const std::filesystem::path> a_paths,
+		format a_format,
+		const chunk_budget& a_budget,
+		compression_level a_level,
+		compression_type a_compression,
+		execution_policy a_policy,
+		compression_format a_compressionFormat)
+		-> std::vector<file>
+	{
+		// every file is read into its own slot, and its chunks are only ever compressed
+		//	independently of one another, so the result can't depend on scheduling
+		// each worker of the shared pool carries a file from parse through compression, so at most
+		//	one file per hardware thread is in flight, and a compressed file's source is unmapped
+		//	before the worker moves on, while a decompressed file's chunks keep referring to its mapping
+		std::vector<file> result(a_paths.size());
+		const auto read = [&](std::size_t a_idx) {
+			result[a_idx].read(
+				a_paths[a_idx],
+				a_format,
+				a_budget,
+				a_level,
+				a_compression,
+				a_compressionFormat);
+		};
+
+		detail::for_each_index(a_paths.size(), read, a_policy);
+		return result;
+	}
+
+	auto archive::measure(
+		format a_format,
+		bool a_strings,
+		const write_options& a_options) const
+		-> size_info
+	{
+		auto info = this->layout_chunk_data(a_format, a_options).second;
+		if (a_strings) {
+			for ([[maybe_unused]] const auto& [key, file] : *this) {
+				info.size += 2u + key.name().size();  // prefixed word length
 			}
 		}
+
+		return info;
 	}
 
-	void file::write_general(detail::ostream_t& a_out) const
+	auto archive::merge(
+		const archive& a_other,
+		bool a_replace)
+		-> std::size_t
 	{
-		std::vector<std::byte> buffer;
-		for (const auto& chunk : *this) {
-			if (chunk.compressed()) {
-				buffer.resize(chunk.decompressed_size());
-				chunk.decompress_into(buffer);
-				a_out.write_bytes(buffer);
+		// chunks compressed for another format have to be recompressed for this one
+		const auto recompress = [&](file& a_file) {
+			if (a_other._compression != _compression) {
+				for (auto& chunk : a_file) {
+					if (chunk.compressed()) {
+						chunk.decompress(a_other._compression);
+						chunk.compress(_compression);
+					}
+				}
+			}
+		};
+
+		std::size_t merged = 0;
+		for (const auto& [key, file] : a_other) {
+			const auto [it, inserted] = this->insert(key, file);
+			if (inserted) {
+				recompress(it->second);
+				++merged;
+			} else if (a_replace) {
+				it->second = file;
+				recompress(it->second);
+				++merged;
+			}
+		}
+
+		return merged;
+	}
+
+	void archive::update(
+		std::filesystem::path a_path,
+		format a_format,
+		bool a_strings,
+		double a_threshold,
+		const write_options& a_options)
+	{
+		// some platforms refuse to replace, or write to, a file which is still mapped, so the
+		//	source is released first, and read back if the file couldn't be touched
+		const auto release_source = [&](auto&& a_func) {
+			const bool mapped = _source != nullptr;
+			if (mapped) {
+				this->clear();
+			}
+			try {
+				a_func();
+			} catch (...) {
+				if (mapped) {
+					this->read(a_path);
+				}
+				throw;
+			}
+		};
+
+		const auto rewrite = [&]() {
+			auto temp = a_path;
+			temp += ".tmp"sv;
+			this->write(temp, a_format, a_strings, a_options);
+			release_source([&]() {
+				try {
+					std::filesystem::rename(temp, a_path);
+				} catch (...) {
+					std::error_code ec;
+					std::filesystem::remove(temp, ec);
+					throw;
+				}
+			});
+			this->read(std::move(a_path));
+		};
+
+		if (!_source) {
+			rewrite();
+			return;
+		}
+
+		const std::span source{ _source->data(), _source->size() };
+		const auto dataOffset = this->offsetof_chunk_data(a_format);
+
+		// chunks still mapped from the source archive can be reused in place, so long as
+		//	they don't overlap the new index
+		const auto find_in_place = [&](const chunk& a_chunk) -> std::optional<std::uint64_t> {
+			const auto bytes = a_chunk.as_bytes();
+			const auto first = reinterpret_cast<std::uintptr_t>(source.data());
+			const auto pos = reinterpret_cast<std::uintptr_t>(bytes.data());
+			if (pos < first || pos + bytes.size() > first + source.size() ||
+				pos - first < dataOffset) {
+				return std::nullopt;
+			} else {
+				return pos - first;
+			}
+		};
+
+		std::vector<std::uint64_t> offsets;
+		std::vector<std::pair<const chunk*, std::uint64_t>> appended;
+		std::unordered_set<std::uint64_t> reused;
+		std::uint64_t live = 0;
+		std::uint64_t end = source.size();
+		for ([[maybe_unused]] const auto& [key, file] : *this) {
+			for (const auto& chunk : file) {
+				auto offset = find_in_place(chunk);
+				if (!offset) {
+					// padding is not counted as dead space, as a compaction would reintroduce it
+					offset = detail::align_chunk(end, chunk.size(), a_options);
+					live += *offset - end + chunk.size();
+					end = *offset + chunk.size();
+					appended.emplace_back(&chunk, *offset);
+				} else if (reused.insert(*offset).second) {
+					live += chunk.size();
+				}
+				offsets.push_back(*offset);
+			}
+		}
+
+		const auto dead = end - dataOffset - live;
+		if (static_cast<double>(dead) > static_cast<double>(end) * a_threshold) {
+			rewrite();
+			return;
+		}
+
+		// the index and string table must be serialized before anything is written, as the
+		//	keys of the archive may still refer to names within the mapped string table
+		binary_io::any_ostream index{ std::in_place_type<binary_io::memory_ostream> };
+		index << detail::header_t{ a_format, _version, _compression, this->size(), a_strings ? end : 0u };
+		this->write_index(index, a_format, offsets);
+		assert(index.get<binary_io::memory_ostream>().rdbuf().size() == dataOffset);
+
+		binary_io::any_ostream strings{ std::in_place_type<binary_io::memory_ostream> };
+		if (a_strings) {
+			for ([[maybe_unused]] const auto& [key, file] : *this) {
+				detail::write_wstring(strings, key.name());
+			}
+		}
+
+		// appended chunks which are mapped from the source are copied out before it is
+		//	released, while any others are kept alive by a copy of their chunk
+		struct pending_t
+		{
+			std::uint64_t offset{ 0 };
+			std::vector<std::byte> copy;
+			chunk kept;
+		};
+
+		std::vector<pending_t> pending;
+		pending.reserve(appended.size());
+		for (const auto& [chunk, offset] : appended) {
+			detail::verify_compression(*chunk, _compression);
+			auto& entry = pending.emplace_back();
+			entry.offset = offset;
+			const auto bytes = chunk->as_bytes();
+			if (bytes.data() >= source.data() && bytes.data() < source.data() + source.size()) {
+				entry.copy.assign(bytes.begin(), bytes.end());
 			} else {
-				a_out.write_bytes(chunk.as_bytes());
+				entry.kept = *chunk;
 			}
 		}
+
+		release_source([&]() {
+			std::fstream out{ a_path, std::ios::in | std::ios::out | std::ios::binary };
+			const auto write = [&](std::span<const std::byte> a_bytes) {
+				out.write(
+					reinterpret_cast<const char*>(a_bytes.data()),
+					static_cast<std::streamsize>(a_bytes.size()));
+			};
+
+			for (const auto& entry : pending) {
+				out.seekp(static_cast<std::streamoff>(entry.offset));
+				write(entry.copy);
+				write(entry.kept.as_bytes());
+			}
+			out.seekp(static_cast<std::streamoff>(end));
+			write(strings.get<binary_io::memory_ostream>().rdbuf());
+
+			out.seekp(0);
+			write(index.get<binary_io::memory_ostream>().rdbuf());
+			out.flush();
+			if (!out) {
+				throw exception("failed to update archive");
+			}
+		});
+
+		this->read(std::move(a_path));
 	}
 
 	auto archive::read(std::filesystem::path a_path)
@@ -724,18 +1842,20 @@ namespace bsa::fo4
 	void archive::write(
 		std::filesystem::path a_path,
 		format a_format,
-		bool a_strings) const
+		bool a_strings,
+		const write_options& a_options) const
 	{
 		binary_io::any_ostream out{ std::in_place_type<binary_io::file_ostream>, std::move(a_path) };
-		this->do_write(out, a_format, a_strings);
+		this->do_write(out, a_format, a_strings, a_options);
 	}
 
 	void archive::write(
 		binary_io::any_ostream& a_dst,
 		format a_format,
-		bool a_strings) const
+		bool a_strings,
+		const write_options& a_options) const
 	{
-		this->do_write(a_dst, a_format, a_strings);
+		this->do_write(a_dst, a_format, a_strings, a_options);
 	}
 
 	auto archive::do_read(detail::istream_t& a_in)
@@ -749,6 +1869,10 @@ namespace bsa::fo4
 
 		this->clear();
 		const auto fmt = static_cast<format>(header.archive_format());
+		_version = header.archive_version();
+		_compression = header.compression();
+		// only an archive mapped from disk is worth remembering, as only it can be updated in place
+		_source = a_in.shallow_copy() ? a_in.file() : nullptr;
 
 		for (std::size_t i = 0, strpos = header.string_table_offset();
 			 i < header.file_count();
@@ -783,21 +1907,34 @@ namespace bsa::fo4
 	void archive::do_write(
 		detail::ostream_t& a_out,
 		format a_format,
-		bool a_strings) const
+		bool a_strings,
+		const write_options& a_options) const
 	{
-		auto [header, dataOffset] = make_header(a_format, a_strings);
-		a_out << header;
-
-		for (const auto& [key, file] : *this) {
-			a_out << key.hash();
-			this->write_file(file, a_out, a_format, dataOffset);
-		}
+		const auto [offsets, info] = this->layout_chunk_data(a_format, a_options);
 
+		// every chunk is validated before anything is written, so a bad chunk never leaves
+		//	a truncated archive behind
+		std::vector<std::pair<std::uint64_t, const chunk*>> chunks;
 		for (const auto& file : *this) {
 			for (const auto& chunk : file.second) {
-				a_out.write_bytes(chunk.as_bytes());
+				detail::verify_compression(chunk, _compression);
+				chunks.emplace_back(offsets[chunks.size()], &chunk);
 			}
 		}
+		std::sort(
+			chunks.begin(),
+			chunks.end(),
+			[](const auto& a_lhs, const auto& a_rhs) { return a_lhs.first < a_rhs.first; });
+
+		a_out << detail::header_t{ a_format, _version, _compression, this->size(), a_strings ? info.size : 0u };
+		this->write_index(a_out, a_format, offsets);
+
+		auto pos = this->offsetof_chunk_data(a_format);
+		for (const auto& [offset, chunk] : chunks) {
+			detail::write_padding(a_out, static_cast<std::size_t>(offset - pos));
+			a_out.write_bytes(chunk->as_bytes());
+			pos = offset + chunk->size();
+		}
 
 		if (a_strings) {
 			for ([[maybe_unused]] const auto& [key, file] : *this) {
@@ -806,10 +1943,58 @@ namespace bsa::fo4
 		}
 	}
 
-	auto archive::make_header(
+	auto archive::layout_chunk_data(
 		format a_format,
-		bool a_strings) const noexcept
-		-> std::pair<detail::header_t, std::uint64_t>
+		const write_options& a_options) const
+		-> std::pair<std::vector<std::uint64_t>, size_info>
+	{
+		// the index of each file's first chunk within the flattened list of offsets
+		std::vector<std::pair<const value_type*, std::size_t>> files;
+		std::size_t chunks = 0;
+		for (const auto& file : *this) {
+			files.emplace_back(&file, chunks);
+			chunks += file.second.size();
+		}
+
+		// records must stay in order, but the chunks they point to are free to be laid out
+		//	in whatever order the caller asks for
+		if (!a_options.payload_order.empty()) {
+			std::unordered_map<const value_type*, std::size_t> ranks;
+			for (const auto& path : a_options.payload_order) {
+				const auto file = this->find(path);
+				if (file != this->end()) {
+					ranks.emplace(&*file, ranks.size());
+				}
+			}
+
+			const auto rank = [&](const value_type* a_file) {
+				const auto it = ranks.find(a_file);
+				return it != ranks.end() ? it->second : ranks.size();
+			};
+			std::stable_sort(
+				files.begin(),
+				files.end(),
+				[&](const auto& a_lhs, const auto& a_rhs) { return rank(a_lhs.first) < rank(a_rhs.first); });
+		}
+
+		std::vector<std::uint64_t> offsets(chunks);
+		size_info info;
+		info.size = this->offsetof_chunk_data(a_format);
+		for (const auto& [file, first] : files) {
+			for (std::size_t i = 0; i < file->second.size(); ++i) {
+				const auto size = file->second[i].size();
+				const auto offset = detail::align_chunk(info.size, size, a_options);
+				info.padding += offset - info.size;
+				offsets[first + i] = offset;
+				info.size = offset + size;
+			}
+		}
+
+		return { std::move(offsets), info };
+	}
+
+	auto archive::offsetof_chunk_data(format a_format) const noexcept
+		-> std::uint64_t
 	{
 		const auto inspect = [&](auto a_gnrl, auto a_dx10) noexcept {
 			switch (a_format) {
@@ -822,31 +2007,21 @@ namespace bsa::fo4
 			}
 		};
 
-		std::uint64_t dataOffset =
-			detail::constants::header_size +
+		std::uint64_t result =
+			detail::header_t::size(_version) +
 			inspect(
 				[]() noexcept { return detail::constants::chunk_header_size_gnrl; },
 				[]() noexcept { return detail::constants::chunk_header_size_dx10; }) *
 				this->size();
-		std::uint64_t dataSize = 0;
 		for ([[maybe_unused]] const auto& [key, file] : *this) {
-			dataOffset +=
+			result +=
 				inspect(
 					[]() noexcept { return detail::constants::chunk_size_gnrl; },
 					[]() noexcept { return detail::constants::chunk_size_dx10; }) *
 				file.size();
-			for (const auto& chunk : file) {
-				dataSize += chunk.size();
-			}
 		}
 
-		return {
-			detail::header_t{
-				a_format,
-				this->size(),
-				a_strings ? dataOffset + dataSize : 0u },
-			dataOffset
-		};
+		return result;
 	}
 
 	void archive::read_chunk(
@@ -920,7 +2095,7 @@ namespace bsa::fo4
 		const chunk& a_chunk,
 		detail::ostream_t& a_out,
 		format a_format,
-		std::uint64_t& a_dataOffset) const noexcept
+		std::uint64_t a_dataOffset) const noexcept
 	{
 		const auto size = a_chunk.size();
 		a_out.write(
@@ -928,7 +2103,6 @@ namespace bsa::fo4
 			static_cast<std::uint32_t>(a_chunk.compressed() ? size : 0u),
 			static_cast<std::uint32_t>(
 				a_chunk.compressed() ? a_chunk.decompressed_size() : size));
-		a_dataOffset += size;
 
 		if (a_format == format::directx) {
 			a_out << a_chunk.mips;
@@ -941,7 +2115,7 @@ namespace bsa::fo4
 		const file& a_file,
 		detail::ostream_t& a_out,
 		format a_format,
-		std::uint64_t& a_dataOffset) const noexcept
+		std::span<const std::uint64_t> a_offsets) const noexcept
 	{
 		a_out.write(
 			std::byte{ 0 },  // skip mod index
@@ -958,8 +2132,20 @@ namespace bsa::fo4
 			detail::declare_unreachable();
 		}
 
-		for (const auto& chunk : a_file) {
-			this->write_chunk(chunk, a_out, a_format, a_dataOffset);
+		for (std::size_t i = 0; i < a_file.size(); ++i) {
+			this->write_chunk(a_file[i], a_out, a_format, a_offsets[i]);
+		}
+	}
+
+	void archive::write_index(
+		detail::ostream_t& a_out,
+		format a_format,
+		std::span<const std::uint64_t> a_offsets) const noexcept
+	{
+		for (const auto& [key, file] : *this) {
+			a_out << key.hash();
+			this->write_file(file, a_out, a_format, a_offsets.subspan(0, file.size()));
+			a_offsets = a_offsets.subspan(file.size());
 		}
 	}
 }
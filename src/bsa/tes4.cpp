@@ -8,13 +8,20 @@
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <random>
 #include <span>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -26,6 +33,9 @@
 #include <lz4hc.h>
 #include <zlib.h>
 
+#include "bsa/detail/codec.hpp"
+#include "bsa/detail/parallel.hpp"
+
 #ifdef BSA_SUPPORT_XMEM
 #	include <Windows.h>
 
@@ -49,6 +59,8 @@ namespace bsa::tes4
 				constexpr std::size_t directory_entry_size_x64 = 0x18;
 				constexpr std::size_t file_entry_size = 0x10;
 				constexpr std::size_t header_size = 0x24;
+
+				constexpr std::size_t compression_sample_size = 1u << 16u;
 			}
 
 			constexpr auto lz4f_decompress_options = []() {
@@ -63,6 +75,22 @@ namespace bsa::tes4
 				pref.autoFlush = 1;
 				return pref;
 			}();
+
+			constexpr auto lz4f_independent_preferences = []() noexcept {
+				auto pref = lz4f_preferences;
+				pref.frameInfo.blockSizeID = LZ4F_max256KB;
+				pref.frameInfo.blockMode = LZ4F_blockIndependent;
+				return pref;
+			}();
+
+			[[nodiscard]] auto lz4f_preferences_for(compression_codec a_codec) noexcept
+				-> const ::LZ4F_preferences_t&
+			{
+				assert(a_codec != compression_codec::xmem);
+				return a_codec == compression_codec::independent_blocks ?
+				           lz4f_independent_preferences :
+				           lz4f_preferences;
+			}
 		}
 
 		class header_t final
@@ -201,6 +229,73 @@ namespace bsa::tes4
 			std::uint16_t _archiveTypes{ 0 };
 		};
 
+		// Decodes the fixed-size records of the index. The byte order of the hashes and the size
+		//	of the directory records are resolved once per archive, rather than once per field.
+		template <std::endian ENDIAN, std::size_t DIRECTORY_SIZE>
+		struct records final
+		{
+			static_assert(
+				DIRECTORY_SIZE == constants::directory_entry_size_x86 ||
+				DIRECTORY_SIZE == constants::directory_entry_size_x64);
+
+			static constexpr std::size_t directory_size = DIRECTORY_SIZE;
+			static constexpr std::size_t file_size = constants::file_entry_size;
+
+			struct directory_t final
+			{
+				tes4::hashing::hash hash;
+				std::uint32_t count{ 0 };
+			};
+
+			struct file_t final
+			{
+				tes4::hashing::hash hash;
+				std::uint32_t size{ 0 };
+				std::uint32_t offset{ 0 };
+			};
+
+			[[nodiscard]] static auto directory(std::span<const std::byte, directory_size> a_src) noexcept
+				-> directory_t
+			{
+				// x64 records pad the count before widening the (unused) offset
+				return { hash(a_src.data()), load<std::uint32_t>(a_src.data() + 0x8) };
+			}
+
+			[[nodiscard]] static auto file(std::span<const std::byte, file_size> a_src) noexcept
+				-> file_t
+			{
+				return {
+					hash(a_src.data()),
+					load<std::uint32_t>(a_src.data() + 0x8),
+					load<std::uint32_t>(a_src.data() + 0xC)
+				};
+			}
+
+		private:
+			template <class T, std::endian E = std::endian::little>
+			[[nodiscard]] static T load(const std::byte* a_src) noexcept
+			{
+				T result;
+				std::memcpy(&result, a_src, sizeof(T));
+				if constexpr (E != std::endian::native) {
+					result = binary_io::endian::reverse(result);
+				}
+				return result;
+			}
+
+			[[nodiscard]] static auto hash(const std::byte* a_src) noexcept
+				-> tes4::hashing::hash
+			{
+				return {
+					.last = static_cast<std::uint8_t>(a_src[0]),
+					.last2 = static_cast<std::uint8_t>(a_src[1]),
+					.length = static_cast<std::uint8_t>(a_src[2]),
+					.first = static_cast<std::uint8_t>(a_src[3]),
+					.crc = load<std::uint32_t, ENDIAN>(a_src + 4),
+				};
+			}
+		};
+
 		namespace
 		{
 			[[nodiscard]] auto offsetof_directory_entries(
@@ -253,6 +348,116 @@ namespace bsa::tes4
 				       a_header.file_names_length();
 			}
 
+			// the size of the bytes which precede a file's payload in the data region
+			[[nodiscard]] auto file_prefix_size(
+				const detail::header_t& a_header,
+				std::string_view a_directory,
+				std::string_view a_file,
+				bool a_compressed) noexcept
+				-> std::size_t
+			{
+				std::size_t result = 0;
+				if (a_header.embedded_file_names()) {
+					result +=
+						1u +  // prefixed byte length
+						a_directory.length() +
+						1u +  // directory separator
+						a_file.length();
+				}
+
+				if (a_compressed) {
+					result += 4u;  // decompressed size
+				}
+
+				return result;
+			}
+
+			using sort_key_t = std::pair<std::uint64_t, std::size_t>;
+
+			// a stable lsd radix sort, which skips any byte shared by every key
+			void radix_sort(std::vector<sort_key_t>& a_keys)
+			{
+				if (a_keys.size() < 2) {
+					return;
+				}
+
+				std::vector<sort_key_t> scratch(a_keys.size());
+				for (std::size_t shift = 0; shift < 64; shift += 8) {
+					std::array<std::size_t, 0x100> counts{};
+					for (const auto& key : a_keys) {
+						++counts[(key.first >> shift) & 0xFF];
+					}
+
+					if (counts[(a_keys.front().first >> shift) & 0xFF] == a_keys.size()) {
+						continue;
+					}
+
+					std::size_t sum = 0;
+					for (auto& count : counts) {
+						sum += std::exchange(count, sum);
+					}
+
+					for (const auto& key : a_keys) {
+						scratch[counts[(key.first >> shift) & 0xFF]++] = key;
+					}
+					a_keys.swap(scratch);
+				}
+			}
+
+			// splits a path into its parent directory and file name
+			[[nodiscard]] auto split_path(std::string_view a_path) noexcept
+				-> std::pair<std::string_view, std::string_view>
+			{
+				const auto pos = a_path.find_last_of("/\\"sv);
+				if (pos != std::string_view::npos) {
+					return { a_path.substr(0, pos), a_path.substr(pos + 1) };
+				} else {
+					return { ""sv, a_path };
+				}
+			}
+
+			// the offset at which to place a payload's prefix, such that the payload which
+			//	follows it is aligned as requested
+			[[nodiscard]] auto align_payload(
+				std::size_t a_offset,
+				std::size_t a_prefix,
+				std::size_t a_size,
+				const write_options& a_options) noexcept
+				-> std::size_t
+			{
+				if (a_size < a_options.alignment_threshold) {
+					return a_offset;
+				} else {
+					return align_up(a_offset + a_prefix, a_options.alignment) - a_prefix;
+				}
+			}
+
+			void write_file_prefix(
+				ostream_t& a_out,
+				const detail::header_t& a_header,
+				std::string_view a_directory,
+				std::string_view a_file,
+				const tes4::file& a_data) noexcept
+			{
+				if (a_header.embedded_file_names()) {
+					const auto len = a_directory.size() +
+					                 1u +  // directory separator
+					                 a_file.size();
+					a_out.write(static_cast<std::uint8_t>(len));
+					a_out.write_bytes({ //
+						reinterpret_cast<const std::byte*>(a_directory.data()),
+						a_directory.size() });
+					a_out.write(std::byte{ '\\' });
+					a_out.write_bytes({ //
+						reinterpret_cast<const std::byte*>(a_file.data()),
+						a_file.size() });
+				}
+
+				if (a_data.compressed()) {
+					a_out.write(static_cast<std::uint32_t>(a_data.decompressed_size()));
+				}
+			}
+
 #ifdef BSA_SUPPORT_XMEM
 			template <class CharT>
 			[[nodiscard]] auto string_split(
@@ -411,19 +616,6 @@ namespace bsa::tes4
 			}
 		}
 
-		void hash::read(
-			detail::istream_t& a_in,
-			std::endian a_endian)
-		{
-			a_in->read(
-				a_endian,
-				last,
-				last2,
-				length,
-				first,
-				crc);
-		}
-
 		void hash::write(
 			detail::ostream_t& a_out,
 			std::endian a_endian) const noexcept
@@ -533,12 +725,13 @@ namespace bsa::tes4
 
 	void file::compress(
 		version a_version,
-		compression_codec a_codec)
+		compression_codec a_codec,
+		execution_policy a_policy)
 	{
 		std::vector<std::byte> out;
 		out.resize(this->compress_bound(a_version, a_codec));
 
-		const auto outsz = this->compress_into(a_version, { out.data(), out.size() }, a_codec);
+		const auto outsz = this->compress_into(a_version, { out.data(), out.size() }, a_codec, a_policy);
 		out.resize(outsz);
 		out.shrink_to_fit();
 		this->set_data(std::move(out), this->size());
@@ -556,12 +749,14 @@ namespace bsa::tes4
 			assert(a_codec == compression_codec::normal);
 			return ::compressBound(static_cast<::uLong>(this->size()));
 		case 104:
+			assert(a_codec != compression_codec::independent_blocks);
 			return a_codec == compression_codec::xmem ?
 			           this->compress_bound_xmem() :
 			           ::compressBound(static_cast<::uLong>(this->size()));
 		case 105:
-			assert(a_codec == compression_codec::normal);
-			return ::LZ4F_compressFrameBound(this->size(), &detail::lz4f_preferences);
+			return ::LZ4F_compressFrameBound(
+				this->size(),
+				&detail::lz4f_preferences_for(a_codec));
 		default:
 			detail::declare_unreachable();
 		}
@@ -570,32 +765,78 @@ namespace bsa::tes4
 	auto file::compress_into(
 		version a_version,
 		std::span<std::byte> a_out,
-		compression_codec a_codec) const
+		compression_codec a_codec,
+		execution_policy a_policy) const
 		-> std::size_t
 	{
 		switch (detail::to_underlying(a_version)) {
 		case 103:
 			assert(a_codec == compression_codec::normal);
-			return this->compress_into_zlib(a_out);
+			return this->compress_into_zlib(a_out, a_policy);
 		case 104:
+			assert(a_codec != compression_codec::independent_blocks);
 			return a_codec == compression_codec::xmem ?
 			           this->compress_into_xmem(a_out) :
-			           this->compress_into_zlib(a_out);
+			           this->compress_into_zlib(a_out, a_policy);
 		case 105:
-			assert(a_codec == compression_codec::normal);
-			return this->compress_into_lz4(a_out);
+			return this->compress_into_lz4(a_out, a_codec);
 		default:
 			detail::declare_unreachable();
 		}
 	}
 
+	bool file::try_compress(
+		version a_version,
+		double a_threshold,
+		compression_codec a_codec,
+		execution_policy a_policy)
+	{
+		assert(!this->compressed());
+
+		// compressed payloads are prefixed with their decompressed size
+		const auto worthwhile = [&](std::size_t a_compressed, std::size_t a_decompressed) noexcept {
+			return static_cast<double>(a_compressed + 4u) <=
+			       static_cast<double>(a_decompressed) * a_threshold;
+		};
+
+		const auto in = this->as_bytes();
+		if (in.empty()) {
+			return false;
+		}
+
+		std::vector<std::byte> out;
+		if (in.size_bytes() >= detail::constants::compression_sample_size * 4u) {
+			file sample;
+			sample.set_data(in.first(detail::constants::compression_sample_size));
+			out.resize(sample.compress_bound(a_version, a_codec));
+			const auto outsz = sample.compress_into(a_version, { out.data(), out.size() }, a_codec);
+			if (!worthwhile(outsz, sample.size())) {
+				return false;
+			}
+		}
+
+		out.resize(this->compress_bound(a_version, a_codec));
+		const auto outsz = this->compress_into(a_version, { out.data(), out.size() }, a_codec, a_policy);
+		if (!worthwhile(outsz, in.size_bytes())) {
+			return false;
+		}
+
+		out.resize(outsz);
+		out.shrink_to_fit();
+		this->set_data(std::move(out), this->size());
+
+		assert(this->compressed());
+		return true;
+	}
+
 	void file::decompress(
 		version a_version,
-		compression_codec a_codec)
+		compression_codec a_codec,
+		execution_policy a_policy)
 	{
 		std::vector<std::byte> out;
 		out.resize(this->decompressed_size());
-		this->decompress_into(a_version, { out.data(), out.size() }, a_codec);
+		this->decompress_into(a_version, { out.data(), out.size() }, a_codec, a_policy);
 		this->set_data(std::move(out));
 
 		assert(!this->compressed());
@@ -604,7 +845,8 @@ namespace bsa::tes4
 	void file::decompress_into(
 		version a_version,
 		std::span<std::byte> a_out,
-		compression_codec a_codec) const
+		compression_codec a_codec,
+		execution_policy a_policy) const
 	{
 		switch (detail::to_underlying(a_version)) {
 		case 103:
@@ -619,14 +861,73 @@ namespace bsa::tes4
 			}
 			break;
 		case 105:
-			assert(a_codec == compression_codec::normal);
-			this->decompress_into_lz4(a_out);
+			assert(a_codec != compression_codec::xmem);
+			this->decompress_into_lz4(a_out, a_policy);
 			break;
 		default:
 			detail::declare_unreachable();
 		}
 	}
 
+	auto file::extract(
+		version a_version,
+		scratch_buffer& a_buffer,
+		compression_codec a_codec,
+		execution_policy a_policy) const
+		-> std::span<const std::byte>
+	{
+		if (this->compressed()) {
+			const auto out = a_buffer.acquire(this->decompressed_size());
+			this->decompress_into(a_version, out, a_codec, a_policy);
+			return out;
+		} else {
+			return this->as_bytes();
+		}
+	}
+
+	auto file::read_range(
+		version a_version,
+		std::size_t a_offset,
+		std::size_t a_length,
+		scratch_buffer& a_buffer,
+		compression_codec a_codec) const
+		-> std::span<const std::byte>
+	{
+		const auto size = this->compressed() ? this->decompressed_size() : this->size();
+		a_offset = (std::min)(a_offset, size);
+		a_length = (std::min)(a_length, size - a_offset);
+
+		if (!this->compressed()) {
+			return this->as_bytes().subspan(a_offset, a_length);
+		} else if (a_length == 0) {
+			return {};
+		}
+
+		const auto out = a_buffer.acquire(a_length);
+		std::size_t pos = 0;
+		std::size_t copied = 0;
+		this->decompress_stream(
+			a_version,
+			a_codec,
+			[&](std::span<const std::byte> a_bytes) {
+				const auto first = pos;
+				pos += a_bytes.size();
+				if (pos > a_offset) {
+					const auto skip = a_offset > first ? a_offset - first : 0;
+					const auto len = (std::min)(a_bytes.size() - skip, a_length - copied);
+					std::copy_n(a_bytes.begin() + skip, len, out.begin() + copied);
+					copied += len;
+				}
+				return copied < a_length;
+			});
+
+		if (copied != a_length) {
+			throw bsa::compression_error(detail::error_code::decompress_size_mismatch);
+		}
+
+		return out;
+	}
+
 	void file::read(
 		std::filesystem::path a_path,
 		version a_version,
@@ -693,11 +994,13 @@ namespace bsa::tes4
 #endif
 	}
 
-	auto file::compress_into_lz4(std::span<std::byte> a_out) const
+	auto file::compress_into_lz4(
+		std::span<std::byte> a_out,
+		compression_codec a_codec) const
 		-> std::size_t
 	{
 		assert(!this->compressed());
-		assert(a_out.size_bytes() >= this->compress_bound(version::sse));
+		assert(a_out.size_bytes() >= this->compress_bound(version::sse, a_codec));
 
 		const auto in = this->as_bytes();
 
@@ -706,7 +1009,7 @@ namespace bsa::tes4
 			a_out.size_bytes(),
 			in.data(),
 			in.size_bytes(),
-			&detail::lz4f_preferences);
+			&detail::lz4f_preferences_for(a_codec));
 		if (::LZ4F_isError(result)) {
 			throw bsa::compression_error(bsa::compression_error::library::lz4, result);
 		}
@@ -751,13 +1054,19 @@ namespace bsa::tes4
 #endif
 	}
 
-	auto file::compress_into_zlib(std::span<std::byte> a_out) const
+	auto file::compress_into_zlib(
+		std::span<std::byte> a_out,
+		execution_policy a_policy) const
 		-> std::size_t
 	{
 		assert(!this->compressed());
 		assert(a_out.size_bytes() >= this->compress_bound(version::tes4));
 
 		const auto in = this->as_bytes();
+		if (const auto outsz = detail::deflate_parallel(in, a_out, Z_DEFAULT_COMPRESSION, MAX_WBITS, a_policy); outsz) {
+			return *outsz;
+		}
+
 		auto outsz = static_cast<::uLong>(a_out.size_bytes());
 
 		const auto result = ::compress(
@@ -772,11 +1081,18 @@ namespace bsa::tes4
 		return static_cast<std::size_t>(outsz);
 	}
 
-	void file::decompress_into_lz4(std::span<std::byte> a_out) const
+	void file::decompress_into_lz4(
+		std::span<std::byte> a_out,
+		execution_policy a_policy) const
 	{
 		assert(this->compressed());
 		assert(a_out.size_bytes() >= this->decompressed_size());
 
+		const auto in = this->as_bytes();
+		if (detail::lz4f_decompress_independent(in, a_out.subspan(0, this->decompressed_size()), a_policy)) {
+			return;
+		}
+
 		::LZ4F_dctx* pdctx = nullptr;
 		if (const auto result = ::LZ4F_createDecompressionContext(&pdctx, LZ4F_VERSION);
 			::LZ4F_isError(result)) {
@@ -787,8 +1103,6 @@ namespace bsa::tes4
 			::LZ4F_freeDecompressionContext
 		};
 
-		const auto in = this->as_bytes();
-
 		std::size_t insz = 0;
 		const std::byte* inptr = in.data();
 		std::size_t outsz = 0;
@@ -879,6 +1193,36 @@ namespace bsa::tes4
 		}
 	}
 
+	template <class Sink>
+	auto file::decompress_stream(
+		version a_version,
+		compression_codec a_codec,
+		Sink&& a_sink) const
+		-> std::size_t
+	{
+		assert(this->compressed());
+
+		switch (detail::to_underlying(a_version)) {
+		case 103:
+		case 104:
+			if (a_codec != compression_codec::xmem) {
+				return detail::inflate_stream(this->as_bytes(), std::forward<Sink>(a_sink));
+			} else {
+				// the xmem proxy can only operate on whole buffers
+				std::vector<std::byte> buffer;
+				buffer.resize(this->decompressed_size());
+				this->decompress_into_xmem(buffer);
+				a_sink(std::span<const std::byte>{ buffer.data(), buffer.size() });
+				return buffer.size();
+			}
+		case 105:
+			assert(a_codec != compression_codec::xmem);
+			return detail::lz4f_stream(this->as_bytes(), std::forward<Sink>(a_sink));
+		default:
+			detail::declare_unreachable();
+		}
+	}
+
 	void file::do_read(
 		detail::istream_t& a_in,
 		version a_version,
@@ -898,95 +1242,429 @@ namespace bsa::tes4
 		compression_codec a_codec) const
 	{
 		if (this->compressed()) {
-			std::vector<std::byte> buffer;
-			buffer.resize(this->decompressed_size());
-			this->decompress_into(a_version, buffer, a_codec);
-			a_out.write_bytes(buffer);
+			const auto written = this->decompress_stream(
+				a_version,
+				a_codec,
+				[&](std::span<const std::byte> a_bytes) {
+					a_out.write_bytes(a_bytes);
+					return true;
+				});
+			if (written != this->decompressed_size()) {
+				throw bsa::compression_error(detail::error_code::decompress_size_mismatch);
+			}
 		} else {
 			a_out.write_bytes(this->as_bytes());
 		}
 	}
 
-	auto archive::read(std::filesystem::path a_path)
+	struct archive::layout_t final
+	{
+		struct directory_t final
+		{
+			const value_type* directory{ nullptr };
+			std::uint64_t offset{ 0 };  // of its file records, as written in its directory record
+		};
+
+		struct file_t final
+		{
+			std::string_view directory;
+			const mapped_type::value_type* file{ nullptr };
+			std::uint32_t size{ 0 };    // including the prefix
+			std::uint64_t offset{ 0 };  // of the prefix
+			std::size_t original{ 0 };  // the index of the file whose payload is shared with this one
+		};
+
+		// offsets are planned at full width, and only narrowed once they're known to fit
+		[[nodiscard]] bool addressable() const noexcept
+		{
+			constexpr std::uint64_t max = (std::numeric_limits<std::int32_t>::max)();
+			return std::all_of(
+					   directories.begin(),
+					   directories.end(),
+					   [](const directory_t& a_dir) noexcept { return a_dir.offset <= max; }) &&
+			       std::all_of(
+					   files.begin(),
+					   files.end(),
+					   [](const file_t& a_file) noexcept { return a_file.offset <= max; });
+		}
+
+		detail::header_t header;
+		std::vector<directory_t> directories;  // in the order they are written
+		std::vector<file_t> files;             // grouped by directory, in the order they are written
+		size_info info;
+	};
+
+	auto archive::read(
+		std::filesystem::path a_path,
+		execution_policy a_policy)
 		-> version
 	{
 		detail::istream_t in{ std::move(a_path) };
-		return this->do_read(in);
+		return this->do_read(in, a_policy);
 	}
 
 	auto archive::read(
 		std::span<const std::byte> a_src,
-		copy_type a_copy)
+		copy_type a_copy,
+		execution_policy a_policy)
 		-> version
 	{
 		detail::istream_t in{ a_src, a_copy };
-		return this->do_read(in);
+		return this->do_read(in, a_policy);
 	}
 
-	bool archive::verify_offsets(version a_version) const noexcept
+	bool archive::verify_offsets(
+		version a_version,
+		const write_options& a_options) const
 	{
-		const auto header = this->make_header(a_version);
-		auto offset = detail::offsetof_file_data(header);
+		return this->plan_layout(a_version, a_options).addressable();
+	}
 
-		std::size_t last = 0;
-		for (const auto& dir : *this) {
-			for (const auto& [key, file] : dir.second) {
-				last = key.name().length() +
-				       1u;  // prefixed byte length
-				if (file.compressed()) {
-					last += 4u;
+	auto archive::measure(
+		version a_version,
+		const write_options& a_options) const
+		-> size_info
+	{
+		return this->plan_layout(a_version, a_options).info;
+	}
+
+	auto archive::merge(
+		const archive& a_other,
+		bool a_replace)
+		-> std::size_t
+	{
+		std::size_t merged = 0;
+		for (const auto& [dirKey, dir] : a_other) {
+			const auto [dirIt, dirInserted] = this->insert(dirKey, directory{});
+			for (const auto& [fileKey, file] : dir) {
+				const auto [it, inserted] = dirIt->second.insert(fileKey, file);
+				if (inserted) {
+					++merged;
+				} else if (a_replace) {
+					it->second = file;
+					++merged;
+				}
+			}
+		}
+
+		return merged;
+	}
+
+	void archive::transcode(
+		version a_from,
+		version a_to,
+		execution_policy a_policy)
+	{
+		// v103 and v104 share zlib, while v105 uses lz4
+		const bool xmem = this->xbox_compressed() && a_from != version::sse;
+		if (!xmem && (a_from == version::sse) == (a_to == version::sse)) {
+			return;
+		}
+
+		std::vector<file*> files;
+		for (auto& dir : *this) {
+			for (auto& f : dir.second) {
+				if (f.second.compressed()) {
+					files.push_back(&f.second);
+				}
+			}
+		}
+
+		if (files.empty()) {
+			if (xmem) {
+				_flags &= ~archive_flag::xbox_compressed;
+			}
+			return;
+		}
+
+		// recompressed payloads are spilled to a temporary file as soon as they're produced,
+		//	and mapped back in once every file is done, so that only the payloads in flight
+		//	are ever resident on the heap
+		auto path = std::filesystem::temp_directory_path();
+		{
+			std::random_device rd;
+			const auto id = std::uint64_t{ rd() } << 32 | rd();
+			path /= "bsa-transcode-"s + std::to_string(id) + ".tmp"s;
+		}
+
+		struct spill_t
+		{
+			std::size_t offset{ 0 };
+			std::size_t size{ 0 };
+			std::size_t decompressed{ 0 };
+		};
+
+		struct buffers_t
+		{
+			scratch_buffer decompressed;
+			scratch_buffer compressed;
+		};
+
+		std::vector<spill_t> spills(files.size());
+		std::mutex lock;
+		std::vector<std::unique_ptr<buffers_t>> idle;  // one set of buffers per worker
+		try {
+			binary_io::file_ostream out{ path };
+			std::size_t offset = 0;
+
+			const auto transcode = [&](std::size_t a_idx) {
+				std::unique_ptr<buffers_t> buffers;
+				{
+					const std::scoped_lock l{ lock };
+					if (idle.empty()) {
+						buffers = std::make_unique<buffers_t>();
+					} else {
+						buffers = std::move(idle.back());
+						idle.pop_back();
+					}
+				}
+
+				// the files are already spread across workers, so each one is coded sequentially
+				const auto bytes = files[a_idx]->extract(
+					a_from,
+					buffers->decompressed,
+					xmem ? compression_codec::xmem : compression_codec::normal,
+					execution_policy::sequential);
+
+				file decompressed;
+				decompressed.set_data(bytes);
+				auto compressed = buffers->compressed.acquire(decompressed.compress_bound(a_to));
+				compressed = compressed.first(decompressed.compress_into(
+					a_to,
+					compressed,
+					compression_codec::normal,
+					execution_policy::sequential));
+
+				const std::scoped_lock l{ lock };
+				out.write_bytes(compressed);
+				spills[a_idx] = { offset, compressed.size(), bytes.size() };
+				offset += compressed.size();
+				idle.push_back(std::move(buffers));
+			};
+
+			if (a_policy == execution_policy::parallel) {
+				detail::parallel_for(files.size(), transcode);
+			} else {
+				for (std::size_t i = 0; i < files.size(); ++i) {
+					transcode(i);
 				}
-				last += file.size();
-				offset += last;
 			}
+		} catch (...) {
+			std::error_code ec;
+			std::filesystem::remove(path, ec);
+			throw;
 		}
 
-		offset -= last;
-		return offset <= (std::numeric_limits<std::int32_t>::max)();
+		idle.clear();
+		const detail::istream_t in{ std::move(path), true };
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			const auto& spill = spills[i];
+			files[i]->set_data(
+				in->rdbuf().subspan(spill.offset, spill.size),
+				in,
+				spill.decompressed);
+		}
+
+		if (xmem) {
+			_flags &= ~archive_flag::xbox_compressed;
+		}
 	}
 
-	void archive::write(std::filesystem::path a_path, version a_version) const
+	void archive::write(
+		std::filesystem::path a_path,
+		version a_version,
+		const write_options& a_options) const
 	{
 		binary_io::any_ostream out{ std::in_place_type<binary_io::file_ostream>, std::move(a_path) };
-		this->do_write(out, a_version);
+		this->do_write(out, a_version, a_options);
 	}
 
-	void archive::write(binary_io::any_ostream& a_dst, version a_version) const
+	void archive::write(
+		binary_io::any_ostream& a_dst,
+		version a_version,
+		const write_options& a_options) const
 	{
-		this->do_write(a_dst, a_version);
+		this->do_write(a_dst, a_version, a_options);
 	}
 
-	struct archive::xbox_sort_t final
+	void archive::update(
+		std::filesystem::path a_path,
+		version a_version,
+		double a_threshold,
+		const write_options& a_options)
 	{
-		// i legitimately have no idea how they sort hashes in the xbox format
-		// it simply defies all reason
+		// some platforms refuse to replace, or write to, a file which is still mapped, so the
+		//	source is released first, and read back if the file couldn't be touched
+		const auto release_source = [&](auto&& a_func) {
+			const bool mapped = _source != nullptr;
+			if (mapped) {
+				this->clear();
+			}
+			try {
+				a_func();
+			} catch (...) {
+				if (mapped) {
+					this->read(a_path);
+				}
+				throw;
+			}
+		};
 
-		template <class T>
-		[[nodiscard]] bool operator()(
-			const T& a_lhs,
-			const T& a_rhs) const noexcept
-		{
-			return key_for(a_lhs) < key_for(a_rhs);
+		const auto rewrite = [&]() {
+			auto temp = a_path;
+			temp += ".tmp"sv;
+			this->write(temp, a_version, a_options);
+			release_source([&]() {
+				try {
+					std::filesystem::rename(temp, a_path);
+				} catch (...) {
+					std::error_code ec;
+					std::filesystem::remove(temp, ec);
+					throw;
+				}
+			});
+			this->read(std::move(a_path));
+		};
+
+		if (!_source) {
+			rewrite();
+			return;
 		}
 
-		[[nodiscard]] static auto key_for(
-			const intermediate_t::value_type& a_value) noexcept
-			-> std::uint64_t
-		{
-			return binary_io::endian::reverse(
-				a_value.first->first.hash().numeric());
+		auto layout = this->plan_records(a_version);
+		const auto& header = layout.header;
+		const std::span source{ _source->data(), _source->size() };
+		const auto dataOffset = detail::offsetof_file_data(header);
+
+		// payloads still mapped from the source archive can be reused in place, so long as
+		//	the bytes which precede them are unchanged, and they don't overlap the new index
+		const auto find_in_place = [&](
+									   std::string_view a_directory,
+									   std::string_view a_file,
+									   const file& a_data,
+									   std::size_t a_prefix) -> std::optional<std::size_t> {
+			const auto bytes = a_data.as_bytes();
+			const auto first = reinterpret_cast<std::uintptr_t>(source.data());
+			const auto pos = reinterpret_cast<std::uintptr_t>(bytes.data());
+			if (pos < first || pos + bytes.size() > first + source.size()) {
+				return std::nullopt;
+			}
+
+			const auto offset = static_cast<std::size_t>(pos - first);
+			if (offset < a_prefix || offset - a_prefix < dataOffset) {
+				return std::nullopt;
+			}
+
+			binary_io::any_ostream prefix{ std::in_place_type<binary_io::memory_ostream> };
+			detail::write_file_prefix(prefix, header, a_directory, a_file, a_data);
+			const auto& expected = prefix.get<binary_io::memory_ostream>().rdbuf();
+			if (!std::equal(expected.begin(), expected.end(), source.begin() + (offset - a_prefix))) {
+				return std::nullopt;
+			}
+
+			return offset - a_prefix;
+		};
+
+		std::vector<const layout_t::file_t*> appended;
+		std::unordered_set<std::size_t> reused;
+		std::size_t live = 0;
+		std::size_t end = source.size();
+		for (auto& file : layout.files) {
+			const auto& [key, data] = *file.file;
+			const std::size_t blobsz = file.size;
+			auto offset = find_in_place(file.directory, key.name(), data, blobsz - data.size());
+			if (offset) {
+				if (reused.insert(*offset).second) {
+					live += blobsz;
+				}
+			} else {
+				// padding is not counted as dead space, as a compaction would reintroduce it
+				offset = detail::align_payload(end, blobsz - data.size(), data.size(), a_options);
+				live += *offset - end + blobsz;
+				end = *offset + blobsz;
+				appended.push_back(&file);
+			}
+
+			if (*offset + blobsz > (std::numeric_limits<std::int32_t>::max)()) {
+				rewrite();
+				return;
+			}
+			file.offset = *offset;
+		}
+
+		const auto dead = end - dataOffset - live;
+		if (static_cast<double>(dead) > static_cast<double>(end) * a_threshold) {
+			rewrite();
+			return;
+		}
+
+		// the index must be serialized before anything is written, as the keys of
+		//	the archive may still refer to names within the mapped index
+		binary_io::any_ostream index{ std::in_place_type<binary_io::memory_ostream> };
+		index << header;
+		this->write_directory_entries(layout, index);
+		this->write_file_entries(layout, index);
+		if (header.file_strings()) {
+			this->write_file_names(layout, index);
 		}
+		const auto& indexBytes = index.get<binary_io::memory_ostream>().rdbuf();
+		assert(indexBytes.size() == dataOffset);
 
-		[[nodiscard]] static auto key_for(
-			const mapped_type::value_type* a_value) noexcept
-			-> std::uint64_t
+		// appended payloads which are mapped from the source are copied out before it is
+		//	released, while any others are kept alive by a copy of their file
+		struct pending_t
 		{
-			return binary_io::endian::reverse(
-				a_value->first.hash().numeric());
+			std::uint32_t offset{ 0 };
+			std::vector<std::byte> head;
+			file kept;
+		};
+
+		std::vector<pending_t> pending;
+		pending.reserve(appended.size());
+		for (const auto file : appended) {
+			const auto& [key, data] = *file->file;
+			binary_io::any_ostream prefix{ std::in_place_type<binary_io::memory_ostream> };
+			detail::write_file_prefix(prefix, header, file->directory, key.name(), data);
+			auto& entry = pending.emplace_back();
+			entry.offset = file->offset;
+			entry.head = std::move(prefix.get<binary_io::memory_ostream>().rdbuf());
+
+			const auto bytes = data.as_bytes();
+			if (bytes.data() >= source.data() && bytes.data() < source.data() + source.size()) {
+				entry.head.insert(entry.head.end(), bytes.begin(), bytes.end());
+			} else {
+				entry.kept = data;
+			}
 		}
-	};
 
-	auto archive::do_read(detail::istream_t& a_in)
+		release_source([&]() {
+			std::fstream out{ a_path, std::ios::in | std::ios::out | std::ios::binary };
+			const auto write = [&](std::span<const std::byte> a_bytes) {
+				out.write(
+					reinterpret_cast<const char*>(a_bytes.data()),
+					static_cast<std::streamsize>(a_bytes.size()));
+			};
+
+			for (const auto& entry : pending) {
+				out.seekp(static_cast<std::streamoff>(entry.offset));
+				write(entry.head);
+				write(entry.kept.as_bytes());
+			}
+
+			out.seekp(0);
+			write(indexBytes);
+			out.flush();
+			if (!out) {
+				throw bsa::exception("failed to update archive");
+			}
+		});
+
+		this->read(std::move(a_path));
+	}
+
+	auto archive::do_read(
+		detail::istream_t& a_in,
+		execution_policy a_policy)
 		-> version
 	{
 		const auto header = [&]() {
@@ -999,92 +1677,270 @@ namespace bsa::tes4
 
 		_flags = header.archive_flags();
 		_types = header.archive_types();
+		// only an archive mapped from disk is worth remembering, as only it can be updated in place
+		_source = a_in.shallow_copy() ? a_in.file() : nullptr;
+
+		// the file string table is walked once up front, rather than once per file entry
+		const auto fileStrings = [&]() -> std::vector<std::string_view> {
+			if (header.file_strings()) {
+				const auto buf = a_in->rdbuf();
+				const auto offset = detail::offsetof_file_strings(header);
+				if (offset > buf.size()) {
+					throw binary_io::buffer_exhausted();
+				}
+				return detail::split_zstrings(buf.subspan(offset), header.file_count());
+			} else {
+				return {};
+			}
+		}();
 
-		std::size_t namesOffset = detail::offsetof_file_strings(header);
-		std::size_t filesOffset = detail::offsetof_file_entries(header);
-		a_in->seek_absolute(header.directories_offset());
-		for (std::size_t i = 0; i < header.directory_count(); ++i) {
-			this->read_directory(a_in, header, filesOffset, namesOffset);
+		const auto read = [&]<std::endian E, std::size_t D>() {
+			this->read_directories<detail::records<E, D>>(a_in, header, fileStrings, a_policy);
+		};
+
+		const bool x64 = header.archive_version() > 104;
+		if (header.endian() == std::endian::big) {
+			x64 ?
+				read.template operator()<std::endian::big, detail::constants::directory_entry_size_x64>() :
+				read.template operator()<std::endian::big, detail::constants::directory_entry_size_x86>();
+		} else {
+			x64 ?
+				read.template operator()<std::endian::little, detail::constants::directory_entry_size_x64>() :
+				read.template operator()<std::endian::little, detail::constants::directory_entry_size_x86>();
 		}
 
 		return static_cast<version>(header.archive_version());
 	}
 
-	void archive::do_write(detail::ostream_t& a_out, version a_version) const
+	void archive::do_write(
+		detail::ostream_t& a_out,
+		version a_version,
+		const write_options& a_options) const
 	{
-		const auto header = this->make_header(a_version);
-		a_out << header;
+		const auto layout = this->plan_layout(a_version, a_options);
+		if (!layout.addressable()) {
+			throw bsa::exception("archive is too large for the offsets of its format");
+		}
 
-		const auto intermediate = sort_for_write(header.xbox_archive());
+		a_out << layout.header;
+		this->write_directory_entries(layout, a_out);
+		this->write_file_entries(layout, a_out);
+		if (layout.header.file_strings()) {
+			this->write_file_names(layout, a_out);
+		}
+		this->write_file_data(layout, a_out);
+	}
 
-		this->write_directory_entries(intermediate, a_out, header);
-		this->write_file_entries(intermediate, a_out, header);
-		if (header.file_strings()) {
-			this->write_file_names(intermediate, a_out);
+	void archive::find_shared_data(
+		layout_t& a_layout,
+		const write_options& a_options) const
+	{
+		// embedded file names prefix each payload with its own name, so they can't be shared
+		if (!a_options.deduplicate || a_layout.header.embedded_file_names()) {
+			return;
+		}
+
+		struct fingerprint_t final
+		{
+			std::size_t size{ 0 };
+			std::size_t decompressed_size{ 0 };
+			::uLong crc{ 0 };
+
+			[[nodiscard]] bool operator==(const fingerprint_t&) const noexcept = default;
+		};
+
+		struct hasher_t final
+		{
+			[[nodiscard]] std::size_t operator()(const fingerprint_t& a_fingerprint) const noexcept
+			{
+				return std::hash<std::size_t>{}(a_fingerprint.size) ^ a_fingerprint.crc;
+			}
+		};
+
+		auto& files = a_layout.files;
+		std::unordered_multimap<fingerprint_t, std::size_t, hasher_t> seen;
+		seen.reserve(files.size());
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			const auto& f = files[i].file->second;
+			const auto bytes = f.as_bytes();
+			const fingerprint_t fingerprint{
+				bytes.size(),
+				f.compressed() ? f.decompressed_size() : 0,
+				::crc32_z(
+					::crc32_z(0, nullptr, 0),
+					reinterpret_cast<const ::Bytef*>(bytes.data()),
+					bytes.size()),
+			};
+
+			const auto [first, last] = seen.equal_range(fingerprint);
+			for (auto it = first; it != last; ++it) {
+				const auto& other = files[it->second].file->second;
+				if (other.compressed() == f.compressed() &&
+					std::memcmp(other.data(), bytes.data(), bytes.size()) == 0) {
+					files[i].original = it->second;
+					break;
+				}
+			}
+
+			if (files[i].original == i) {
+				seen.emplace(fingerprint, i);
+			}
 		}
-		this->write_file_data(intermediate, a_out, header);
 	}
 
-	auto archive::make_header(version a_version) const noexcept
-		-> detail::header_t
+	auto archive::plan_layout(
+		version a_version,
+		const write_options& a_options) const
+		-> layout_t
 	{
-		detail::header_t::info_t files;
-		detail::header_t::info_t dirs;
+		auto layout = this->plan_records(a_version);
+		this->find_shared_data(layout, a_options);
+		this->layout_file_data(layout, a_options);
+		return layout;
+	}
 
-		for (const auto& dir : *this) {
-			dirs.count += 1;
+	auto archive::plan_records(version a_version) const
+		-> layout_t
+	{
+		layout_t layout;
+		auto& [header, directories, files, info] = layout;
 
+		detail::header_t::info_t fileInfo;
+		detail::header_t::info_t dirInfo;
+		directories.reserve(this->size());
+		for (const auto& dir : *this) {
+			directories.push_back({ &dir });
+			dirInfo.count += 1;
 			if (this->directory_strings()) {
-				dirs.blobsz += static_cast<std::uint32_t>(
+				dirInfo.blobsz += static_cast<std::uint32_t>(
 					dir.first.name().length() +
 					1u);  // null terminator
 			}
 
+			fileInfo.count += static_cast<std::uint32_t>(dir.second.size());
 			for (const auto& file : dir.second) {
-				files.count += 1;
-
 				if (this->file_strings()) {
-					files.blobsz += static_cast<std::uint32_t>(
+					fileInfo.blobsz += static_cast<std::uint32_t>(
 						file.first.name().length() +
 						1u);  // null terminator
 				}
 			}
 		}
 
-		return {
+		header = {
 			a_version,
 			_flags,
 			_types,
-			dirs,
-			files
+			dirInfo,
+			fileInfo
 		};
+
+		if (header.xbox_archive()) {
+			// i legitimately have no idea how they sort hashes in the xbox format
+			// it simply defies all reason
+			const auto key_for = [](const auto& a_key) noexcept {
+				return binary_io::endian::reverse(a_key.hash().numeric());
+			};
+
+			std::vector<detail::sort_key_t> keys;
+			keys.reserve(directories.size());
+			for (std::size_t i = 0; i < directories.size(); ++i) {
+				keys.push_back({ key_for(directories[i].directory->first), i });
+			}
+			detail::radix_sort(keys);
+
+			std::vector<layout_t::directory_t> sorted;
+			sorted.reserve(directories.size());
+			for (const auto& key : keys) {
+				sorted.push_back(directories[key.second]);
+			}
+			directories = std::move(sorted);
+		}
+
+		files.reserve(fileInfo.count);
+		for (const auto& dir : directories) {
+			const auto dirname = dir.directory->first.name();
+			const auto first = files.size();
+			for (const auto& file : dir.directory->second) {
+				const auto i = files.size();
+				files.push_back({
+					dirname,
+					&file,
+					static_cast<std::uint32_t>(
+						file.second.size() +
+						detail::file_prefix_size(
+							header,
+							dirname,
+							file.first.name(),
+							file.second.compressed())),
+					0,
+					i,
+				});
+			}
+
+			if (header.xbox_archive()) {
+				std::vector<detail::sort_key_t> keys;
+				keys.reserve(files.size() - first);
+				for (std::size_t i = first; i < files.size(); ++i) {
+					keys.push_back({ binary_io::endian::reverse(files[i].file->first.hash().numeric()), i });
+				}
+				detail::radix_sort(keys);
+
+				std::vector<layout_t::file_t> sorted;
+				sorted.reserve(keys.size());
+				for (const auto& key : keys) {
+					sorted.push_back(files[key.second]);
+					sorted.back().original = first + sorted.size() - 1;
+				}
+				std::copy(sorted.begin(), sorted.end(), files.begin() + first);
+			}
+		}
+
+		std::uint64_t offset =
+			detail::offsetof_file_entries(header) +
+			header.file_names_length();
+		for (auto& dir : directories) {
+			dir.offset = offset;
+			if (header.directory_strings()) {
+				offset +=
+					dir.directory->first.name().length() +
+					1u +  // prefixed byte length
+					1u;   // null terminator
+			}
+
+			offset +=
+				detail::constants::file_entry_size *
+				dir.directory->second.size();
+		}
+
+		return layout;
 	}
 
+	template <class Records>
 	auto archive::read_file_entries(
 		directory& a_dir,
 		detail::istream_t& a_in,
 		const detail::header_t& a_header,
 		std::size_t a_count,
-		std::size_t& a_namesOffset)
+		std::span<const std::string_view>& a_names)
 		-> std::optional<std::string_view>
 	{
 		std::optional<std::string_view> dirname;
 
 		for (std::size_t i = 0; i < a_count; ++i) {
-			hashing::hash hash;
-			hash.read(a_in, a_header.endian());
-
-			auto [size, offset] = a_in->read<std::uint32_t, std::uint32_t>();
+			auto [hash, size, offset] = Records::file(
+				a_in->read_bytes(Records::file_size).template first<Records::file_size>());
 
 			const detail::restore_point _{ a_in };
 			a_in->seek_absolute(offset & ~file::isecondary_archive);
 
 			const auto tableName = [&]() -> std::optional<std::string_view> {
 				if (a_header.file_strings()) {
-					const detail::restore_point r{ a_in };
-					a_in->seek_absolute(a_namesOffset);
-					const auto name = detail::read_zstring(a_in);
-					a_namesOffset = a_in->tell();
+					if (a_names.empty()) {
+						throw binary_io::buffer_exhausted();
+					}
+					const auto name = a_names.front();
+					a_names = a_names.subspan(1);
 					return name;
 				} else {
 					return std::nullopt;
@@ -1147,207 +2003,241 @@ namespace bsa::tes4
 		a_file.set_data(a_in->read_bytes(a_size), a_in, decompsz);
 	}
 
-	void archive::read_directory(
+	template <class Records>
+	void archive::read_directories(
 		detail::istream_t& a_in,
 		const detail::header_t& a_header,
-		std::size_t& a_filesOffset,
-		std::size_t& a_namesOffset)
+		std::span<const std::string_view> a_names,
+		execution_policy a_policy)
 	{
-		hashing::hash hash;
-		hash.read(a_in, a_header.endian());
+		struct block_t final
+		{
+			hashing::hash hash;
+			std::size_t count{ 0 };
+			std::size_t filesOffset{ 0 };
+			std::size_t namesOffset{ 0 };
+			directory dir;
+			std::optional<std::string_view> name;
+		};
 
-		const auto [count] = a_in->read<std::uint32_t>();
+		// the position of every directory's file records, and of their names within the
+		//	string table, is a prefix sum over the directories which precede it, so only
+		//	the directory records themselves need to be walked in sequence
 
-		// bsarch is known to corrupt the file entries offset,
-		// so we have to calculate it by hand instead
-		switch (a_header.archive_version()) {
-		case 103:
-		case 104:
-			a_in->seek_relative(4u);
-			break;
-		case 105:
-			a_in->seek_relative(4u * 3u);
-			break;
-		default:
-			detail::declare_unreachable();
+		// the directory count is untrusted, so it's bounded by the records which can actually
+		//	be present before anything is allocated for them
+		const auto size = a_in->rdbuf().size();
+		const auto records = std::uint64_t{ a_header.directory_count() } * Records::directory_size;
+		if (a_header.directories_offset() > size || records > size - a_header.directories_offset()) {
+			throw binary_io::buffer_exhausted();
 		}
 
-		const detail::restore_point _{ a_in };
-		a_in->seek_absolute(a_filesOffset);
+		// bsarch is known to corrupt the file entries offset,
+		// so we have to calculate it by hand instead
+		std::vector<block_t> blocks(a_header.directory_count());
+		std::size_t filesOffset = detail::offsetof_file_entries(a_header);
+		std::size_t namesOffset = 0;
+		a_in->seek_absolute(a_header.directories_offset());
+		for (auto& block : blocks) {
+			const auto [hash, count] = Records::directory(
+				a_in->read_bytes(Records::directory_size).template first<Records::directory_size>());
+			block.hash = hash;
+			block.count = count;
+			block.filesOffset = filesOffset;
+			block.namesOffset = namesOffset;
 
-		const auto tableName =
-			a_header.directory_strings() ?
-				std::make_optional(detail::read_bzstring(a_in)) :
-				std::nullopt;
+			if (a_header.directory_strings()) {
+				const detail::restore_point _{ a_in };
+				a_in->seek_absolute(filesOffset);
+				const auto [len] = a_in->read<std::uint8_t>();
+				filesOffset += 1u + len;  // include prefixed byte length
+			}
+			filesOffset += count * detail::constants::file_entry_size;
+			namesOffset += count;
+		}
 
-		directory d;
-		const auto embeddedName = this->read_file_entries(d, a_in, a_header, count, a_namesOffset);
+		if (a_header.file_strings() && namesOffset > a_names.size()) {
+			throw binary_io::buffer_exhausted();
+		}
 
-		// prefer directory string table name, see #7
-		const auto dname =
-			tableName    ? *tableName :
-			embeddedName ? *embeddedName :
-						   ""sv;
+		const auto parse = [&](std::size_t a_idx) {
+			auto& block = blocks[a_idx];
+			auto in = a_in.fork();
+			in->seek_absolute(block.filesOffset);
 
-		[[maybe_unused]] const auto [it, success] =
-			this->insert(
-				key_type{ hash, dname, a_in },
-				std::move(d));
-		assert(success);
+			const auto tableName =
+				a_header.directory_strings() ?
+					std::make_optional(detail::read_bzstring(in)) :
+					std::nullopt;
 
-		a_filesOffset = a_in->tell();
-	}
+			auto names =
+				a_header.file_strings() ?
+					a_names.subspan(block.namesOffset, block.count) :
+					std::span<const std::string_view>{};
+			const auto embeddedName = this->read_file_entries<Records>(block.dir, in, a_header, block.count, names);
 
-	auto archive::sort_for_write(bool a_xbox) const noexcept
-		-> intermediate_t
-	{
-		intermediate_t result;
-		result.reserve(this->size());
-		for (const auto& dir : *this) {
-			auto& elem = result.emplace_back();
-			elem.first = &dir;
-			elem.second.reserve(dir.second.size());
-			for (const auto& file : dir.second) {
-				elem.second.push_back(&file);
-			}
+			// prefer directory string table name, see #7
+			block.name = tableName ? tableName : embeddedName;
+		};
 
-			if (a_xbox) {
-				std::sort(elem.second.begin(), elem.second.end(), xbox_sort_t{});
+		if (a_policy == execution_policy::parallel) {
+			detail::parallel_for(blocks.size(), parse);
+		} else {
+			for (std::size_t i = 0; i < blocks.size(); ++i) {
+				parse(i);
 			}
 		}
 
-		if (a_xbox) {
-			std::sort(result.begin(), result.end(), xbox_sort_t{});
+		for (auto& block : blocks) {
+			[[maybe_unused]] const auto [it, success] =
+				this->insert(
+					key_type{ block.hash, block.name.value_or(""sv), a_in },
+					std::move(block.dir));
+			assert(success);
 		}
-
-		return result;
 	}
 
 	void archive::write_directory_entries(
-		const intermediate_t& a_intermediate,
-		detail::ostream_t& a_out,
-		const detail::header_t& a_header) const noexcept
+		const layout_t& a_layout,
+		detail::ostream_t& a_out) const noexcept
 	{
-		auto offset = static_cast<std::uint32_t>(detail::offsetof_file_entries(a_header));
-		offset += static_cast<std::uint32_t>(a_header.file_names_length());
-
-		for (const auto& elem : a_intermediate) {
-			const auto& [key, dir] = *elem.first;
-			key.hash().write(a_out, a_header.endian());
-			a_out.write(static_cast<std::uint32_t>(dir.size()));
+		const auto& header = a_layout.header;
+		for (const auto& [dir, offset] : a_layout.directories) {
+			const auto& [key, files] = *dir;
+			key.hash().write(a_out, header.endian());
+			a_out.write(static_cast<std::uint32_t>(files.size()));
 
-			switch (a_header.archive_version()) {
+			switch (header.archive_version()) {
 			case 103:
 			case 104:
-				a_out.write(offset);
+				a_out.write(static_cast<std::uint32_t>(offset));
 				break;
 			case 105:
 				a_out.write(
 					std::uint32_t{ 0 },
-					offset,
+					static_cast<std::uint32_t>(offset),
 					std::uint32_t{ 0 });
 				break;
 			default:
 				detail::declare_unreachable();
 			}
-
-			if (a_header.directory_strings()) {
-				offset += static_cast<std::uint32_t>(
-					key.name().length() +
-					1u +  // prefixed byte length
-					1u);  // null terminator
-			}
-
-			offset += static_cast<std::uint32_t>(
-				detail::constants::file_entry_size *
-				dir.size());
 		}
 	}
 
 	void archive::write_file_data(
-		const intermediate_t& a_intermediate,
-		detail::ostream_t& a_out,
-		const detail::header_t& a_header) const noexcept
+		const layout_t& a_layout,
+		detail::ostream_t& a_out) const noexcept
 	{
-		for (const auto& elem : a_intermediate) {
-			const auto& dir = *elem.first;
-			const auto dirname = dir.first.name();
-			std::span dirbytes{
-				reinterpret_cast<const std::byte*>(dirname.data()),
-				dirname.size()
-			};
-
-			for (const auto file : elem.second) {
-				if (a_header.embedded_file_names()) {
-					const auto fname = file->first.name();
-					const auto len = dirbytes.size() +
-					                 1u +  // directory separator
-					                 fname.size();
-					a_out.write(static_cast<std::uint8_t>(len));
-					a_out.write_bytes(dirbytes);
-					a_out.write(std::byte{ '\\' });
-					a_out.write_bytes({ //
-						reinterpret_cast<const std::byte*>(fname.data()),
-						fname.size() });
-				}
-
-				if (file->second.compressed()) {
-					a_out.write(static_cast<std::uint32_t>(file->second.decompressed_size()));
-				}
-
-				a_out.write_bytes(file->second.as_bytes());
+		const auto& files = a_layout.files;
+		std::vector<const layout_t::file_t*> order;
+		order.reserve(files.size());
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			if (files[i].original == i) {
+				order.push_back(&files[i]);
 			}
 		}
+		std::sort(
+			order.begin(),
+			order.end(),
+			[](const layout_t::file_t* a_lhs, const layout_t::file_t* a_rhs) noexcept {
+				return a_lhs->offset < a_rhs->offset;
+			});
+
+		std::size_t pos = detail::offsetof_file_data(a_layout.header);
+		for (const auto file : order) {
+			const auto& [key, data] = *file->file;
+			detail::write_padding(a_out, file->offset - pos);
+			detail::write_file_prefix(a_out, a_layout.header, file->directory, key.name(), data);
+			a_out.write_bytes(data.as_bytes());
+			pos = static_cast<std::size_t>(file->offset) + file->size;
+		}
 	}
 
 	void archive::write_file_entries(
-		const intermediate_t& a_intermediate,
-		detail::ostream_t& a_out,
-		const detail::header_t& a_header) const noexcept
+		const layout_t& a_layout,
+		detail::ostream_t& a_out) const noexcept
 	{
-		auto offset = static_cast<std::uint32_t>(detail::offsetof_file_data(a_header));
-		for (const auto& elem : a_intermediate) {
-			const auto& dir = *elem.first;
-			if (a_header.directory_strings()) {
-				detail::write_bzstring(a_out, dir.first.name());
+		const auto& header = a_layout.header;
+		auto file = a_layout.files.begin();
+		for (const auto& dir : a_layout.directories) {
+			const auto& [key, files] = *dir.directory;
+			if (header.directory_strings()) {
+				detail::write_bzstring(a_out, key.name());
 			}
 
-			for (const auto file : elem.second) {
-				file->first.hash().write(a_out, a_header.endian());
-				auto fsize = file->second.size();
-
-				if (!!a_header.compressed() != !!file->second.compressed()) {
+			for (const auto last = file + files.size(); file != last; ++file) {
+				file->file->first.hash().write(a_out, header.endian());
+				auto fsize = file->size;
+				if (!!header.compressed() != !!file->file->second.compressed()) {
 					fsize |= file::icompression;
 				}
 
-				if (a_header.embedded_file_names()) {
-					fsize += static_cast<std::uint32_t>(
-						1u +  // prefixed byte length
-						dir.first.name().length() +
-						1u +  // directory separator
-						file->first.name().length());
-				}
+				a_out.write(fsize, static_cast<std::uint32_t>(file->offset));
+			}
+		}
+	}
 
-				if (file->second.compressed()) {
-					fsize += 4u;
+	void archive::layout_file_data(
+		layout_t& a_layout,
+		const write_options& a_options) const
+	{
+		auto& files = a_layout.files;
+
+		// records must stay in hash order, but the payloads they point to are free to be laid out
+		//	in whatever order the caller asks for
+		std::vector<std::size_t> order(files.size());
+		std::iota(order.begin(), order.end(), std::size_t{ 0 });
+		if (!a_options.payload_order.empty()) {
+			std::unordered_map<const mapped_type::value_type*, std::size_t> ranks;
+			for (const auto& path : a_options.payload_order) {
+				const auto [dirname, filename] = detail::split_path(path);
+				const auto dir = this->find(dirname);
+				if (dir != this->end()) {
+					const auto file = dir->second.find(filename);
+					if (file != dir->second.end()) {
+						ranks.emplace(&*file, ranks.size());
+					}
 				}
+			}
 
-				a_out.write(
-					static_cast<std::uint32_t>(fsize),
-					offset);
-				offset += static_cast<std::uint32_t>(fsize & ~file::icompression);
+			const auto rank = [&](std::size_t a_idx) {
+				const auto it = ranks.find(files[a_idx].file);
+				return it != ranks.end() ? it->second : ranks.size();
+			};
+			std::stable_sort(
+				order.begin(),
+				order.end(),
+				[&](std::size_t a_lhs, std::size_t a_rhs) { return rank(a_lhs) < rank(a_rhs); });
+		}
+
+		auto& info = a_layout.info;
+		info.size = detail::offsetof_file_data(a_layout.header);
+		for (const auto i : order) {
+			auto& file = files[i];
+			if (file.original == i) {
+				const auto payload = file.file->second.size();
+				const auto offset = detail::align_payload(
+					info.size,
+					file.size - payload,
+					payload,
+					a_options);
+				info.padding += offset - info.size;
+				file.offset = offset;
+				info.size = offset + file.size;
 			}
 		}
+
+		for (auto& file : files) {
+			file.offset = files[file.original].offset;
+		}
 	}
 
 	void archive::write_file_names(
-		const intermediate_t& a_intermediate,
+		const layout_t& a_layout,
 		detail::ostream_t& a_out) const noexcept
 	{
-		for (const auto& elem : a_intermediate) {
-			for (const auto file : elem.second) {
-				detail::write_zstring(a_out, file->first.name());
-			}
+		for (const auto& file : a_layout.files) {
+			detail::write_zstring(a_out, file.file->first.name());
 		}
 	}
 }
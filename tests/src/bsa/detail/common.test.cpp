@@ -1,7 +1,9 @@
 #include "utility.hpp"
 
 #include <array>
+#include <cstddef>
 #include <filesystem>
+#include <span>
 #include <system_error>
 #include <utility>
 
@@ -42,4 +44,21 @@ TEST_CASE("bsa::functional", "[src][common]")
 		REQUIRE(bsa::make_four_cc("ABCD"sv) == 0x44434241);
 		REQUIRE(bsa::make_four_cc("ABCDE"sv) == 0x44434241);
 	}
+
+	SECTION("split_zstrings")
+	{
+		constexpr auto table = "foo\0\0bar.nif\0"sv;
+		const auto bytes = std::as_bytes(std::span{ table.data(), table.size() });
+
+		const auto names = bsa::detail::split_zstrings(bytes, 3);
+		REQUIRE(names.size() == 3);
+		REQUIRE(names[0] == "foo"sv);
+		REQUIRE(names[1] == ""sv);
+		REQUIRE(names[2] == "bar.nif"sv);
+		REQUIRE(names[2].data() == table.data() + 5);
+
+		REQUIRE(bsa::detail::split_zstrings(bytes, 0).empty());
+		REQUIRE_THROWS(bsa::detail::split_zstrings(bytes, 4));
+		REQUIRE_THROWS(bsa::detail::split_zstrings(bytes.first(3), 1));
+	}
 }
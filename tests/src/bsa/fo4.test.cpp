@@ -1,14 +1,18 @@
 #include "utility.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
+#include <functional>
 #include <span>
 #include <string>
 #include <string_view>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include <DirectXTex.h>
 
@@ -211,6 +215,24 @@ TEST_CASE("bsa::fo4::chunk", "[src][fo4][vfs]")
 		REQUIRE(chunk.mips.first == 0);
 		REQUIRE(chunk.mips.last == 0);
 	}
+
+	SECTION("large chunks can be compressed in parallel")
+	{
+		const auto payload = make_compressible_payload(1u << 21u);
+
+		for (const auto level : { bsa::fo4::compression_level::normal, bsa::fo4::compression_level::xbox }) {
+			bsa::fo4::chunk chunk;
+			chunk.set_data({ payload.data(), payload.size() });
+			chunk.compress(level, bsa::execution_policy::parallel);
+			REQUIRE(chunk.compressed());
+			REQUIRE(chunk.size() < payload.size());
+
+			chunk.decompress();
+			assert_byte_equality(
+				chunk.as_bytes(),
+				std::span{ payload.data(), payload.size() });
+		}
+	}
 }
 
 TEST_CASE("bsa::fo4::file", "[src][fo4][vfs]")
@@ -228,6 +250,140 @@ TEST_CASE("bsa::fo4::file", "[src][fo4][vfs]")
 		REQUIRE(file.header.flags == 0);
 		REQUIRE(file.header.tile_mode == 0);
 	}
+
+	SECTION("dds headers match those encoded by DirectXTex")
+	{
+		const auto check = [](::DXGI_FORMAT a_format, bool a_cubemap) {
+			bsa::fo4::file f;
+			f.header.width = 64;
+			f.header.height = 32;
+			f.header.mip_count = 1;
+			f.header.format = static_cast<std::uint8_t>(a_format);
+			f.header.flags = a_cubemap ? 1u : 0u;
+
+			binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+			f.write(os, bsa::fo4::format::directx);
+			const auto& bytes = os.get<binary_io::memory_ostream>().rdbuf();
+
+			const DirectX::TexMetadata meta{
+				.width = 64,
+				.height = 32,
+				.depth = 1,
+				.arraySize = a_cubemap ? 6u : 1u,
+				.mipLevels = 1,
+				.miscFlags = a_cubemap ? std::uint32_t{ DirectX::TEX_MISC_FLAG::TEX_MISC_TEXTURECUBE } : 0u,
+				.miscFlags2 = 0,
+				.format = a_format,
+				.dimension = DirectX::TEX_DIMENSION_TEXTURE2D,
+			};
+			std::size_t required = 0;
+			REQUIRE(SUCCEEDED(DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, nullptr, 0, required)));
+			std::vector<std::byte> expected(required);
+			REQUIRE(SUCCEEDED(DirectX::EncodeDDSHeader(meta, DirectX::DDS_FLAGS_NONE, expected.data(), expected.size(), required)));
+			assert_byte_equality(std::span{ bytes }, std::span{ expected });
+		};
+
+		for (const bool cubemap : { false, true }) {
+			check(DXGI_FORMAT_BC1_UNORM, cubemap);
+			check(DXGI_FORMAT_BC7_UNORM, cubemap);
+		}
+		check(DXGI_FORMAT_R8G8B8A8_UNORM, false);
+		check(DXGI_FORMAT_R8G8_SNORM, false);
+		check(DXGI_FORMAT_R16G16_FLOAT, false);
+		check(DXGI_FORMAT_YUY2, false);
+
+		bsa::fo4::file f;
+		const std::array<std::byte, 0x10> payload{};
+		f.emplace_back().set_data({ payload.data(), payload.size() });
+		REQUIRE_THROWS_AS(
+			f.write("fo4_missing_directory/out.bin"sv, bsa::fo4::format::general),
+			bsa::exception);
+	}
+
+	SECTION("texture files can be read in batches")
+	{
+		const std::array<std::filesystem::path, 3> paths{
+			"fo4_chunk_test/test.dds"sv,
+			"fo4_cubemap_test/blacksky_e.dds"sv,
+			"fo4_dds_test/Fence006_1K_Roughness.dds"sv,
+		};
+
+		const auto read = [&](bsa::execution_policy a_policy) {
+			return bsa::fo4::read_files(
+				paths,
+				bsa::fo4::format::directx,
+				256u,
+				256u,
+				bsa::fo4::compression_level::normal,
+				bsa::compression_type::compressed,
+				a_policy);
+		};
+
+		const auto sequential = read(bsa::execution_policy::sequential);
+		const auto parallel = read(bsa::execution_policy::parallel);
+		REQUIRE(sequential.size() == paths.size());
+		REQUIRE(parallel.size() == paths.size());
+
+		for (std::size_t i = 0; i < paths.size(); ++i) {
+			bsa::fo4::file expected;
+			expected.read(
+				paths[i],
+				bsa::fo4::format::directx,
+				256u,
+				256u,
+				bsa::fo4::compression_level::normal,
+				bsa::compression_type::compressed);
+
+			for (const auto& f : { std::cref(sequential[i]), std::cref(parallel[i]) }) {
+				const auto& file = f.get();
+				REQUIRE(file.header.width == expected.header.width);
+				REQUIRE(file.header.height == expected.header.height);
+				REQUIRE(file.header.mip_count == expected.header.mip_count);
+				REQUIRE(file.header.format == expected.header.format);
+				REQUIRE(file.header.flags == expected.header.flags);
+				REQUIRE(file.size() == expected.size());
+				for (std::size_t j = 0; j < expected.size(); ++j) {
+					REQUIRE(file[j].compressed());
+					REQUIRE(file[j].mips.first == expected[j].mips.first);
+					REQUIRE(file[j].mips.last == expected[j].mips.last);
+					REQUIRE(file[j].decompressed_size() == expected[j].decompressed_size());
+					REQUIRE(std::ranges::equal(file[j].as_bytes(), expected[j].as_bytes()));
+				}
+			}
+		}
+
+		const bsa::fo4::chunk_budget budget{ .size = 0x1'0000 };
+		const auto budgeted = bsa::fo4::read_files(
+			paths,
+			bsa::fo4::format::directx,
+			budget,
+			bsa::fo4::compression_level::normal,
+			bsa::compression_type::compressed,
+			bsa::execution_policy::parallel,
+			bsa::fo4::compression_format::lz4);
+		REQUIRE(budgeted.size() == paths.size());
+		for (std::size_t i = 0; i < paths.size(); ++i) {
+			bsa::fo4::file expected;
+			expected.read(
+				paths[i],
+				bsa::fo4::format::directx,
+				budget,
+				bsa::fo4::compression_level::normal,
+				bsa::compression_type::compressed,
+				bsa::fo4::compression_format::lz4);
+
+			REQUIRE(budgeted[i].size() == expected.size());
+			for (std::size_t j = 0; j < expected.size(); ++j) {
+				REQUIRE(budgeted[i][j].mips.first == expected[j].mips.first);
+				REQUIRE(budgeted[i][j].mips.last == expected[j].mips.last);
+				REQUIRE(std::ranges::equal(budgeted[i][j].as_bytes(), expected[j].as_bytes()));
+
+				bsa::scratch_buffer buffer;
+				REQUIRE(budgeted[i][j].extract(buffer, bsa::fo4::compression_format::lz4).size() ==
+						expected[j].decompressed_size());
+			}
+		}
+	}
 }
 
 TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
@@ -392,6 +548,83 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 		}
 	}
 
+	SECTION("archives preserve the order of their records")
+	{
+		const std::array names{
+			"textures\\z.dds"sv,
+			"meshes\\a.nif"sv,
+			"sound\\m.wav"sv,
+			"interface\\b.swf"sv,
+		};
+		const std::array payloads{
+			"zzzz"sv,
+			"aaaa"sv,
+			"mmmm"sv,
+			"bbbb"sv,
+		};
+
+		bsa::fo4::archive ba2;
+		for (std::size_t i = 0; i < names.size(); ++i) {
+			bsa::fo4::file f;
+			f.emplace_back().set_data(std::as_bytes(std::span{ payloads[i] }));
+			REQUIRE(ba2.insert(names[i], std::move(f)).second);
+		}
+		REQUIRE(!ba2.insert(names[2], bsa::fo4::file{}).second);
+
+		const auto verify = [&](const bsa::fo4::archive& a_archive) {
+			REQUIRE(a_archive.size() == names.size());
+			std::size_t i = 0;
+			for (const auto& [key, file] : a_archive) {
+				REQUIRE(key.name() == names[i]);
+				REQUIRE(a_archive[names[i]]);
+				++i;
+			}
+		};
+		verify(ba2);
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		ba2.write(os, bsa::fo4::format::general);
+		const auto& out = os.get<binary_io::memory_ostream>().rdbuf();
+
+		bsa::fo4::archive in;
+		REQUIRE(in.read(std::span{ out.data(), out.size() }, bsa::copy_type::shallow) == bsa::fo4::format::general);
+		verify(in);
+
+		// payloads are laid out in record order, so the source is read sequentially
+		const std::byte* last = nullptr;
+		for (const auto& [key, file] : in) {
+			REQUIRE(file.front().data() > last);
+			last = file.front().data();
+		}
+
+		binary_io::any_ostream again{ std::in_place_type<binary_io::memory_ostream> };
+		in.write(again, bsa::fo4::format::general);
+		assert_byte_equality(again.get<binary_io::memory_ostream>().rdbuf(), out);
+
+		auto copy = in;
+		verify(copy);
+		REQUIRE(copy.erase(names[1]));
+		REQUIRE(!copy[names[1]]);
+		REQUIRE(copy[names[3]]);
+		REQUIRE(copy.size() == names.size() - 1);
+		verify(in);
+	}
+
+	SECTION("archives can be built from many threads at once")
+	{
+		test_flat_builder<bsa::fo4::archive>(
+			[](std::size_t a_idx) { return "textures\\file" + std::to_string(a_idx) + ".dds"; },
+			[](std::span<const std::byte> a_data) {
+				bsa::fo4::file f;
+				f.emplace_back().set_data(a_data);
+				return f;
+			},
+			[](const bsa::fo4::file& a_file) {
+				REQUIRE(a_file.size() == 1);
+				return a_file.front().data();
+			});
+	}
+
 	SECTION("archives do not have to contain a string table")
 	{
 		const std::filesystem::path root{ "fo4_missing_string_table_test"sv };
@@ -425,6 +658,7 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 			std::make_pair("xbox.ba2"sv, bsa::fo4::compression_level::xbox),
 		};
 
+		bsa::scratch_buffer buffer;
 		for (const auto& [archive, compression] : archives) {
 			bsa::fo4::archive ba2;
 			REQUIRE(ba2.read(root / archive) == bsa::fo4::format::general);
@@ -445,6 +679,7 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 						disk.size() });
 					diskC.compress(compression);
 					assert_byte_equality(archC.as_bytes(), diskC.as_bytes());
+					assert_byte_equality(archC.extract(buffer), std::span{ disk.data(), disk.size() });
 
 					archC.decompress();
 					REQUIRE(!archC.compressed());
@@ -454,6 +689,324 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 		}
 	}
 
+	SECTION("newer archive versions can contain lz4 compressed chunks")
+	{
+		const std::filesystem::path root{ "fo4_compression_test"sv };
+		const auto disk = map_file(root / "data/characters/character_0000.png"sv);
+		const std::span bytes{ disk.data(), disk.size() };
+		const std::array versions{
+			std::make_tuple(bsa::fo4::version::v1, bsa::fo4::compression_format::zip, std::size_t{ 0x18 }),
+			std::make_tuple(bsa::fo4::version::v2, bsa::fo4::compression_format::zip, std::size_t{ 0x20 }),
+			std::make_tuple(bsa::fo4::version::v3, bsa::fo4::compression_format::zip, std::size_t{ 0x24 }),
+			std::make_tuple(bsa::fo4::version::v3, bsa::fo4::compression_format::lz4, std::size_t{ 0x24 }),
+		};
+
+		for (const auto& [version, compression, headerSize] : versions) {
+			bsa::fo4::file f;
+			auto& c = f.emplace_back();
+			c.set_data(bytes);
+			c.compress(compression);
+			REQUIRE(c.compressed());
+
+			bsa::fo4::archive ba2;
+			ba2.archive_version(version);
+			ba2.archive_compression(compression);
+			ba2.insert("misc/example.fuz"sv, std::move(f));
+
+			binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+			ba2.write(os, bsa::fo4::format::general);
+			const auto& out = os.get<binary_io::memory_ostream>().rdbuf();
+			REQUIRE(ba2.measure(bsa::fo4::format::general).size == out.size());
+
+			bsa::fo4::archive in;
+			REQUIRE(in.read(std::span{ out.data(), out.size() }, bsa::copy_type::shallow) == bsa::fo4::format::general);
+			REQUIRE(in.archive_version() == version);
+			REQUIRE(in.archive_compression() == compression);
+
+			const auto read = in["misc/example.fuz"sv];
+			REQUIRE(read);
+			REQUIRE(read->size() == 1);
+			const auto& chunk = read->front();
+			REQUIRE(chunk.compressed());
+			REQUIRE(chunk.as_bytes().data() == out.data() + headerSize + 0x10 + 0x14);
+
+			bsa::scratch_buffer buffer;
+			assert_byte_equality(chunk.extract(buffer, compression), bytes);
+
+			binary_io::any_ostream extracted{ std::in_place_type<binary_io::memory_ostream> };
+			read->write(extracted, bsa::fo4::format::general, compression);
+			assert_byte_equality(extracted.get<binary_io::memory_ostream>().rdbuf(), bytes);
+		}
+
+		bsa::fo4::archive ba2;
+		ba2.archive_compression(bsa::fo4::compression_format::lz4);
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		REQUIRE_THROWS_AS(ba2.write(os, bsa::fo4::format::general), bsa::exception);
+
+		// chunks compressed for the wrong format are caught when writing, and recompressed when merging
+		const auto make = [&](bsa::fo4::compression_format a_compression) {
+			bsa::fo4::file f;
+			f.read(
+				bytes,
+				bsa::fo4::format::general,
+				512u,
+				512u,
+				bsa::fo4::compression_level::normal,
+				bsa::compression_type::compressed,
+				bsa::copy_type::deep,
+				a_compression);
+			bsa::fo4::archive result;
+			result.archive_version(bsa::fo4::version::v3);
+			result.archive_compression(a_compression);
+			result.insert("misc/example.fuz"sv, std::move(f));
+			return result;
+		};
+
+		for (const auto compression : { bsa::fo4::compression_format::zip, bsa::fo4::compression_format::lz4 }) {
+			const auto other = compression == bsa::fo4::compression_format::zip ?
+			                       bsa::fo4::compression_format::lz4 :
+			                       bsa::fo4::compression_format::zip;
+			auto mismatched = make(other);
+			mismatched.archive_compression(compression);
+			binary_io::any_ostream rejected{ std::in_place_type<binary_io::memory_ostream> };
+			REQUIRE_THROWS_AS(mismatched.write(rejected, bsa::fo4::format::general), bsa::exception);
+			REQUIRE(rejected.get<binary_io::memory_ostream>().rdbuf().empty());  // nothing is written before the check
+
+			auto dst = make(compression);
+			dst.clear();
+			dst.archive_version(bsa::fo4::version::v3);
+			dst.archive_compression(compression);
+			REQUIRE(dst.merge(make(other)) == 1);
+			binary_io::any_ostream merged{ std::in_place_type<binary_io::memory_ostream> };
+			dst.write(merged, bsa::fo4::format::general);
+
+			bsa::scratch_buffer buffer;
+			assert_byte_equality(dst["misc/example.fuz"sv]->front().extract(buffer, compression), bytes);
+		}
+	}
+
+	SECTION("we can merge archives without recompressing their files")
+	{
+		const std::filesystem::path root{ "fo4_compression_test"sv };
+		bsa::fo4::archive src;
+		REQUIRE(src.read(root / "normal.ba2"sv) == bsa::fo4::format::general);
+		REQUIRE(!src.empty());
+
+		bsa::fo4::archive dst;
+		REQUIRE(dst.merge(src) == src.size());
+		REQUIRE(dst.merge(src) == 0);
+		REQUIRE(dst.merge(src, true) == src.size());
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		dst.write(os, bsa::fo4::format::general);
+
+		bsa::fo4::archive out;
+		REQUIRE(out.read(os.get<binary_io::memory_ostream>().rdbuf()) == bsa::fo4::format::general);
+		REQUIRE(out.size() == src.size());
+		for (const auto& [key, file] : src) {
+			const auto merged = dst[key.name()];
+			const auto read = out[key.name()];
+			REQUIRE(merged);
+			REQUIRE(read);
+			REQUIRE(merged->size() == file.size());
+			REQUIRE(read->size() == file.size());
+			for (std::size_t i = 0; i < file.size(); ++i) {
+				REQUIRE(file[i].compressed());
+				REQUIRE((*merged)[i].data() == file[i].data());
+				assert_byte_equality((*read)[i].as_bytes(), file[i].as_bytes());
+			}
+		}
+	}
+
+	SECTION("archives mapped from disk can be given a residency hint")
+	{
+		const std::filesystem::path path{ "fo4_dds_test/in.ba2"sv };
+		REQUIRE(bsa::residency_hint() == 0);
+
+		bsa::fo4::archive unhinted;
+		unhinted.read(path);
+		REQUIRE(unhinted.residency_hint() == 0);
+
+		// the default is captured when an archive is read
+		bsa::residency_hint(1);
+		bsa::fo4::archive global;
+		global.read(path);
+		bsa::residency_hint(0);
+		REQUIRE(global.residency_hint() == 1);
+
+		// and can be overridden per archive afterwards
+		bsa::fo4::archive local;
+		local.read(path);
+		local.residency_hint(1);
+		REQUIRE(local.residency_hint() == 1);
+		REQUIRE(unhinted.residency_hint() == 0);
+
+		// evicted regions must be paged back in intact when they're touched again
+		for (const auto* hinted : { &global, &local }) {
+			for (int pass = 0; pass < 2; ++pass) {
+				for (const auto& [key, file] : unhinted) {
+					const auto other = (*hinted)[key.name()];
+					REQUIRE(other);
+					REQUIRE(other->size() == file.size());
+					for (std::size_t i = 0; i < file.size(); ++i) {
+						assert_byte_equality((*other)[i].as_bytes(), file[i].as_bytes());
+					}
+				}
+			}
+		}
+
+		local.residency_hint(0);
+		REQUIRE(local.residency_hint() == 0);
+
+		// archives which weren't read from disk have no mapping to hint
+		bsa::fo4::archive empty;
+		empty.residency_hint(1);
+		REQUIRE(empty.residency_hint() == 0);
+	}
+
+	SECTION("chunks can be aligned when writing")
+	{
+		const auto format = bsa::fo4::format::general;
+		bsa::fo4::archive ba2;
+		std::vector<std::vector<std::byte>> payloads;
+		for (const auto size : { 0x10u, 0x1'234u, 0x20u, 0x3'000u }) {
+			auto& payload = payloads.emplace_back(size, static_cast<std::byte>(size));
+			bsa::fo4::file f;
+			f.emplace_back().set_data({ payload.data(), payload.size() });
+			REQUIRE(ba2.insert("file" + std::to_string(size) + ".bin", std::move(f)).second);
+		}
+
+		const bsa::fo4::write_options options{
+			.alignment = 0x1'000,
+			.alignment_threshold = 0x100,
+		};
+		const auto packed = ba2.measure(format);
+		const auto aligned = ba2.measure(format, true, options);
+		REQUIRE(packed.padding == 0);
+		REQUIRE(aligned.padding > 0);
+		REQUIRE(aligned.size == packed.size + aligned.padding);
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		ba2.write(os, format, true, options);
+		const auto& buffer = os.get<binary_io::memory_ostream>().rdbuf();
+		REQUIRE(buffer.size() == aligned.size);
+
+		bsa::fo4::archive in;
+		REQUIRE(in.read({ buffer.data(), buffer.size() }, bsa::copy_type::shallow) == format);
+		for (const auto& payload : payloads) {
+			const auto file = in["file" + std::to_string(payload.size()) + ".bin"];
+			REQUIRE(file);
+			REQUIRE(file->size() == 1);
+			const auto& chunk = file->front();
+			assert_byte_equality(chunk.as_bytes(), std::span{ payload.data(), payload.size() });
+			const auto offset = static_cast<std::size_t>(chunk.data() - buffer.data());
+			if (payload.size() >= options.alignment_threshold) {
+				REQUIRE(offset % options.alignment == 0);
+			}
+		}
+	}
+
+	SECTION("chunks can be laid out in a caller-provided order")
+	{
+		const auto format = bsa::fo4::format::general;
+		bsa::fo4::archive ba2;
+		std::vector<std::vector<std::byte>> payloads;
+		for (const auto name : { "a.bin"sv, "b.bin"sv, "c.bin"sv, "d.bin"sv }) {
+			bsa::fo4::file f;
+			for (std::size_t i = 0; i < 2; ++i) {
+				auto& payload = payloads.emplace_back(0x10, static_cast<std::byte>(payloads.size()));
+				f.emplace_back().set_data({ payload.data(), payload.size() });
+			}
+			REQUIRE(ba2.insert(name, std::move(f)).second);
+		}
+
+		const std::array<std::string, 3> order{ "d.bin", "missing.bin", "B.BIN" };
+		const bsa::fo4::write_options options{ .payload_order = order };
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		ba2.write(os, format, true, options);
+		const auto& buffer = os.get<binary_io::memory_ostream>().rdbuf();
+		REQUIRE(buffer.size() == ba2.measure(format).size);
+
+		bsa::fo4::archive in;
+		REQUIRE(in.read({ buffer.data(), buffer.size() }, bsa::copy_type::shallow) == format);
+		const auto offset = [&](std::string_view a_name, std::size_t a_chunk) {
+			const auto file = in[a_name];
+			REQUIRE(file);
+			REQUIRE(file->size() == 2);
+			assert_byte_equality((*file)[a_chunk].as_bytes(), (*ba2[a_name])[a_chunk].as_bytes());
+			return (*file)[a_chunk].data() - buffer.data();
+		};
+
+		REQUIRE(offset("d.bin"sv, 0) < offset("d.bin"sv, 1));
+		REQUIRE(offset("d.bin"sv, 1) < offset("b.bin"sv, 0));
+		REQUIRE(offset("b.bin"sv, 1) < offset("a.bin"sv, 0));
+		REQUIRE(offset("a.bin"sv, 1) < offset("c.bin"sv, 0));
+	}
+
+	SECTION("archives can be updated in place")
+	{
+		const std::filesystem::path root{ "fo4_compression_test"sv };
+		// declared first, so it outlives the archives which map it
+		const temporary_path temporary{ "update.ba2"sv };
+		const auto& path = temporary.get();
+		const auto format = bsa::fo4::format::general;
+		{
+			bsa::fo4::archive src;
+			REQUIRE(src.read(root / "normal.ba2"sv) == format);
+			src.write(path, format);
+		}
+
+		bsa::fo4::archive ba2;
+		REQUIRE(ba2.read(path) == format);
+		REQUIRE(ba2.size() > 1);
+		const auto original = std::filesystem::file_size(path);
+		const std::string replaced{ ba2.begin()->first.name() };
+
+		std::array<std::byte, 0x100> payload{};
+		payload.fill(std::byte{ 0x42 });
+		bsa::fo4::file f;
+		f.emplace_back().set_data({ payload.data(), payload.size() });
+		ba2.find(replaced)->second = std::move(f);
+
+		std::size_t strings = 0;
+		for ([[maybe_unused]] const auto& [key, file] : ba2) {
+			strings += 2 + key.name().size();
+		}
+
+		const auto verify = [&]() {
+			bsa::fo4::archive in;
+			REQUIRE(in.read(path) == format);
+			REQUIRE(in.size() == ba2.size());
+			bsa::scratch_buffer buffer;
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(root / "data"sv)) {
+				if (entry.is_regular_file()) {
+					const auto p = std::filesystem::relative(entry.path(), root / "data"sv).string();
+					const auto file = in[p];
+					REQUIRE(file);
+					REQUIRE(file->size() == 1);
+					if (file->front().compressed()) {
+						const auto disk = map_file(entry.path());
+						assert_byte_equality(file->front().extract(buffer), std::span{ disk.data(), disk.size() });
+					} else {
+						assert_byte_equality(file->front().as_bytes(), std::span{ payload.data(), payload.size() });
+					}
+				}
+			}
+		};
+
+		ba2.update(path, format, true, 1.0);
+		REQUIRE(std::filesystem::file_size(path) == original + payload.size() + strings);
+		verify();
+
+		ba2.update(path, format, true, 0.0);
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		ba2.write(os, format);
+		REQUIRE(std::filesystem::file_size(path) == os.get<binary_io::memory_ostream>().rdbuf().size());
+		verify();
+
+	}
+
 	SECTION("we can read/write archives without touching the disk")
 	{
 		test_in_memory_buffer<bsa::fo4::archive>(
@@ -519,6 +1072,90 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 			});
 	}
 
+	SECTION("texture files can be chunked by a byte budget")
+	{
+		const auto path = std::filesystem::path{ "fo4_chunk_test"sv } / "test.dds"sv;
+		const auto read = [&](const bsa::fo4::chunk_budget& a_budget) {
+			bsa::fo4::file f;
+			f.read(path, bsa::fo4::format::directx, a_budget);
+
+			std::vector<std::pair<std::uint16_t, std::uint16_t>> result;
+			for (const auto& chunk : f) {
+				result.emplace_back(chunk.mips.first, chunk.mips.last);
+			}
+			return result;
+		};
+
+		using mips_t = std::vector<std::pair<std::uint16_t, std::uint16_t>>;
+
+		// the default budget matches the default dimensions
+		REQUIRE(read({}) == mips_t{ { 0, 0 }, { 1, 1 }, { 2, 10 } });
+
+		// derived from the format of the texture
+		REQUIRE(read({ .width = 256, .height = 256 }) == mips_t{ { 0, 0 }, { 1, 1 }, { 2, 2 }, { 3, 10 } });
+
+		// an explicit byte budget
+		REQUIRE(read({ .size = 0x10'0000 }) == mips_t{ { 0, 10 } });
+		REQUIRE(read({ .size = 0x3'0000 }) == mips_t{ { 0, 0 }, { 1, 10 } });
+
+		// the last chunk absorbs whatever mips remain
+		REQUIRE(read({ .size = 0x100, .count = 2 }) == mips_t{ { 0, 0 }, { 1, 10 } });
+		REQUIRE(read({ .size = 0x100, .count = 0 }) == mips_t{ { 0, 10 } });
+	}
+
+	SECTION("texture files are chunked without copying their contents")
+	{
+		const std::filesystem::path root{ "fo4_chunk_test"sv };
+		const auto disk = map_file(root / "test.dds"sv);
+		const std::span src{ disk.data(), disk.size() };
+
+		bsa::fo4::file f;
+		f.read(
+			src,
+			bsa::fo4::format::directx,
+			512u,
+			512u,
+			bsa::fo4::compression_level::normal,
+			bsa::compression_type::decompressed,
+			bsa::copy_type::shallow);
+
+		REQUIRE(f.size() == 3);
+		std::size_t offset = 0x80;  // the dds header
+		for (const auto& chunk : f) {
+			REQUIRE(!chunk.compressed());
+			REQUIRE(chunk.data() == src.data() + offset);
+			offset += chunk.size();
+		}
+		REQUIRE(offset == src.size());
+	}
+
+	SECTION("texture files with corrupt mip counts are rejected")
+	{
+		const auto disk = map_file("fo4_chunk_test/test.dds"sv);
+		std::vector<std::byte> src(disk.data(), disk.data() + disk.size());
+		const auto patch = [&](std::size_t a_offset, std::uint32_t a_value) {
+			std::memcpy(src.data() + a_offset, &a_value, sizeof(a_value));
+		};
+
+		std::uint32_t flags = 0;
+		std::memcpy(&flags, src.data() + 0x8, sizeof(flags));
+		patch(0x8, flags | 0x20000);  // DDSD_MIPMAPCOUNT
+		for (const std::uint32_t mips : { 0xFFFF'FFFFu, 65u }) {
+			patch(0x1C, mips);
+			bsa::fo4::file f;
+			REQUIRE_THROWS_AS(
+				f.read(
+					std::span{ src.data(), src.size() },
+					bsa::fo4::format::directx,
+					512u,
+					512u,
+					bsa::fo4::compression_level::normal,
+					bsa::compression_type::decompressed,
+					bsa::copy_type::shallow),
+				bsa::exception);
+		}
+	}
+
 	SECTION("we can create texture archives using cubemaps")
 	{
 		const std::filesystem::path root{ "fo4_cubemap_test"sv };
@@ -540,6 +1177,30 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 		REQUIRE(f[0].mips.last == 9);
 		REQUIRE(f[0].decompressed_size() == 0x20'00A0);
 
+		// faces may straddle the chunks of files which were split by hand
+		{
+			bsa::fo4::file whole;
+			whole.read(root / filename, bsa::fo4::format::directx);
+			REQUIRE(whole.size() == 1);
+			const auto bytes = whole[0].as_bytes();
+
+			bsa::fo4::file split;
+			split.header = whole.header;
+			const auto half = bytes.size() / 2 + 0x123;
+			split.emplace_back().set_data(bytes.first(half));
+			split.emplace_back().set_data(bytes.subspan(half));
+
+			for (const std::size_t first : { 1u, 4u }) {
+				binary_io::any_ostream expected{ std::in_place_type<binary_io::memory_ostream> };
+				whole.write_mips(expected, first);
+				binary_io::any_ostream actual{ std::in_place_type<binary_io::memory_ostream> };
+				split.write_mips(actual, first);
+				assert_byte_equality(
+					std::span{ actual.get<binary_io::memory_ostream>().rdbuf() },
+					std::span{ expected.get<binary_io::memory_ostream>().rdbuf() });
+			}
+		}
+
 		bsa::fo4::archive ba2;
 		REQUIRE(ba2.insert(filename, std::move(f)).second);
 
@@ -592,6 +1253,42 @@ TEST_CASE("bsa::fo4::archive", "[src][fo4][archive]")
 			});
 	}
 
+	SECTION("we can write a subset of the mips of texture files")
+	{
+		const std::filesystem::path root{ "fo4_dds_test"sv };
+		const auto filename = "Fence006_1K_Roughness.dds"sv;
+
+		bsa::fo4::archive ba2;
+		REQUIRE(ba2.read(root / "in.ba2"sv) == bsa::fo4::format::directx);
+		const auto archived = ba2[filename];
+		REQUIRE(archived);
+		REQUIRE_THROWS_AS(
+			archived->write_mips(root / "mips.dds"sv, archived->header.mip_count),
+			bsa::exception);
+
+		const auto disk = map_file(root / filename);
+		const std::span original{ disk.data(), disk.size() };
+
+		constexpr std::array<std::pair<std::size_t, std::size_t>, 2> mips{ {
+			{ 1, 0x100'000 },                        // starts on a chunk boundary
+			{ 3, 0x100'000 + 0x40'000 + 0x10'000 },  // starts inside of a chunk
+		} };
+		for (const auto& [first, skipped] : mips) {
+			binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+			archived->write_mips(os, first);
+			const auto out = std::span{ os.get<binary_io::memory_ostream>().rdbuf() };
+
+			REQUIRE(out.size() >= sizeof(dds10_header_t));
+			const auto header = reinterpret_cast<const dds10_header_t*>(out.data());
+			REQUIRE(header->header9.header.dwWidth == static_cast<std::uint32_t>(archived->header.width >> first));
+			REQUIRE(header->header9.header.dwHeight == static_cast<std::uint32_t>(archived->header.height >> first));
+			REQUIRE(header->header9.header.dwMipMapCount == archived->header.mip_count - first);
+			assert_byte_equality(
+				out.subspan(sizeof(dds10_header_t)),
+				original.subspan(sizeof(dds10_header_t) + skipped));
+		}
+	}
+
 	SECTION("we can read/write directx files")
 	{
 		const std::filesystem::path root{ "fo4_dx9_test"sv };
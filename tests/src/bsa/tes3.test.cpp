@@ -11,6 +11,7 @@
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include "catch2.hpp"
 #include <mmio/mmio.hpp>
@@ -200,6 +201,18 @@ TEST_CASE("bsa::tes3::archive", "[src][tes3][archive]")
 		}
 	}
 
+	SECTION("archives can be built from many threads at once")
+	{
+		test_flat_builder<bsa::tes3::archive>(
+			[](std::size_t a_idx) { return "file" + std::to_string(a_idx) + ".txt"; },
+			[](std::span<const std::byte> a_data) {
+				bsa::tes3::file f;
+				f.set_data(a_data);
+				return f;
+			},
+			[](const bsa::tes3::file& a_file) { return a_file.data(); });
+	}
+
 	SECTION("we can validate the offsets within an archive (<4gb)")
 	{
 		bsa::tes3::archive bsa;
@@ -4,10 +4,12 @@
 #include <cstring>
 #include <exception>
 #include <filesystem>
+#include <initializer_list>
 #include <iterator>
 #include <limits>
 #include <memory>
 #include <span>
+#include <string>
 #include <string_view>
 #include <system_error>
 #include <utility>
@@ -244,6 +246,12 @@ TEST_CASE("bsa::tes4::archive", "[src][tes4][archive]")
 				REQUIRE(read->decompressed_size() == original.decompressed_size());
 				assert_byte_equality(read->as_bytes(), original.as_bytes());
 
+				binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+				read->write(os, version);
+				assert_byte_equality(
+					os.get<binary_io::memory_ostream>().rdbuf(),
+					std::span{ origsrc.data(), origsrc.size() });
+
 				read->decompress(version);
 				assert_byte_equality(read->as_bytes(), std::span{ origsrc.data(), origsrc.size() });
 			}
@@ -296,6 +304,37 @@ TEST_CASE("bsa::tes4::archive", "[src][tes4][archive]")
 		}
 	}
 
+	SECTION("the index can be parsed in parallel")
+	{
+		const std::filesystem::path root{ "tes4_xbox_read_test"sv };
+
+		for (const auto name : { "normal.bsa"sv, "xbox.bsa"sv }) {
+			bsa::tes4::archive sequential;
+			sequential.read(root / name, bsa::execution_policy::sequential);
+
+			bsa::tes4::archive parallel;
+			parallel.read(root / name, bsa::execution_policy::parallel);
+
+			REQUIRE(sequential.size() == parallel.size());
+			auto dpar = parallel.begin();
+			for (const auto& dseq : sequential) {
+				REQUIRE(dpar != parallel.end());
+				REQUIRE(dseq.first.hash() == dpar->first.hash());
+				REQUIRE(dseq.first.name() == dpar->first.name());
+				REQUIRE(dseq.second.size() == dpar->second.size());
+
+				for (const auto& fseq : dseq.second) {
+					const auto fpar = dpar->second.find(fseq.first.hash());
+					REQUIRE(fpar != dpar->second.end());
+					REQUIRE(fseq.first.name() == fpar->first.name());
+					assert_byte_equality(fseq.second.as_bytes(), fpar->second.as_bytes());
+				}
+
+				++dpar;
+			}
+		}
+	}
+
 	SECTION("we can write archives written in the xbox format")
 	{
 		const std::filesystem::path root{ "tes4_xbox_write_test"sv };
@@ -337,6 +376,526 @@ TEST_CASE("bsa::tes4::archive", "[src][tes4][archive]")
 		}
 	}
 
+	SECTION("we can transcode archives between versions")
+	{
+		const std::filesystem::path root{ "tes4_compression_test"sv };
+		constexpr std::array files{
+			"License.txt"sv,
+			"Preview.png"sv,
+		};
+
+		bsa::tes4::archive bsa;
+		const auto from = bsa.read(root / "test_104.bsa"sv);
+		REQUIRE(from == bsa::tes4::version::tes5);
+
+		const auto roundtrip = [&](bsa::tes4::version a_to, bsa::execution_policy a_policy) {
+			bsa.transcode(from, a_to, a_policy);
+
+			binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+			bsa.write(os, a_to);
+
+			bsa::tes4::archive out;
+			REQUIRE(out.read(os.get<binary_io::memory_ostream>().rdbuf()) == a_to);
+			for (const auto name : files) {
+				const auto file = out["."sv][name];
+				REQUIRE(file);
+				REQUIRE(file->compressed());
+
+				bsa::scratch_buffer buffer;
+				const auto disk = map_file(root / name);
+				assert_byte_equality(
+					file->extract(a_to, buffer),
+					std::span{ disk.data(), disk.size() });
+			}
+		};
+
+		roundtrip(bsa::tes4::version::sse, bsa::execution_policy::parallel);
+		bsa.transcode(bsa::tes4::version::sse, from, bsa::execution_policy::sequential);
+		roundtrip(from, bsa::execution_policy::sequential);
+	}
+
+	SECTION("we can merge archives without recompressing their files")
+	{
+		const std::filesystem::path root{ "tes4_compression_test"sv };
+		bsa::tes4::archive src;
+		const auto version = src.read(root / "test_105.bsa"sv);
+
+		const std::array<std::byte, 1u << 4> payload{};
+		bsa::tes4::archive dst;
+		for (const auto& [dir, name] : {
+				 std::make_pair("."sv, "License.txt"sv),
+				 std::make_pair("misc"sv, "other.txt"sv) }) {
+			bsa::tes4::file f;
+			f.set_data({ payload.data(), payload.size() });
+			bsa::tes4::directory d;
+			REQUIRE(d.insert(name, std::move(f)).second);
+			REQUIRE(dst.insert(dir, std::move(d)).second);
+		}
+
+		REQUIRE(dst.merge(src) == 1);
+		REQUIRE(dst["."sv]["License.txt"sv]->data() == payload.data());
+		REQUIRE(dst.merge(src, true) == 2);
+
+		for (const auto name : { "License.txt"sv, "Preview.png"sv }) {
+			const auto from = src["."sv][name];
+			const auto to = dst["."sv][name];
+			REQUIRE(from);
+			REQUIRE(to);
+			REQUIRE(to->compressed());
+			REQUIRE(to->data() == from->data());
+			REQUIRE(to->size() == from->size());
+		}
+
+		dst.archive_flags(src.archive_flags());
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		dst.write(os, version);
+
+		bsa::tes4::archive out;
+		REQUIRE(out.read(os.get<binary_io::memory_ostream>().rdbuf()) == version);
+		REQUIRE(out["misc"sv]["other.txt"sv]);
+		bsa::scratch_buffer buffer;
+		for (const auto name : { "License.txt"sv, "Preview.png"sv }) {
+			const auto disk = map_file(root / name);
+			assert_byte_equality(
+				out["."sv][name]->extract(version, buffer),
+				std::span{ disk.data(), disk.size() });
+		}
+	}
+
+	SECTION("identical payloads can be written only once")
+	{
+		std::vector<std::byte> payload(0x1'000);
+		for (std::size_t i = 0; i < payload.size(); ++i) {
+			payload[i] = static_cast<std::byte>(i % 251u);
+		}
+		const std::array<std::byte, 0x10> other{};
+
+		const auto version = bsa::tes4::version::sse;
+		bsa::tes4::archive bsa;
+		bsa.archive_flags(
+			bsa::tes4::archive_flag::directory_strings |
+			bsa::tes4::archive_flag::file_strings);
+		for (const auto dir : { "a"sv, "b"sv, "c"sv }) {
+			bsa::tes4::directory d;
+			for (const auto name : { "copy.dds"sv, "unique.nif"sv }) {
+				bsa::tes4::file f;
+				if (name == "copy.dds"sv) {
+					f.set_data({ payload.data(), payload.size() });
+				} else {
+					std::vector<std::byte> bytes(other.begin(), other.end());
+					bytes[0] = static_cast<std::byte>(dir[0]);
+					f.set_data(std::move(bytes));
+				}
+				REQUIRE(d.insert(name, std::move(f)).second);
+			}
+			REQUIRE(bsa.insert(dir, std::move(d)).second);
+		}
+
+		const auto write = [&](bool a_deduplicate) {
+			binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+			bsa.write(os, version, { .deduplicate = a_deduplicate });
+			return std::move(os.get<binary_io::memory_ostream>().rdbuf());
+		};
+
+		const auto full = write(false);
+		const auto dedup = write(true);
+		REQUIRE(dedup.size() == full.size() - 2 * payload.size());
+
+		bsa::tes4::archive in;
+		REQUIRE(in.read({ dedup.data(), dedup.size() }) == version);
+		for (const auto dir : { "a"sv, "b"sv, "c"sv }) {
+			const auto copy = in[dir]["copy.dds"sv];
+			REQUIRE(copy);
+			assert_byte_equality(copy->as_bytes(), std::span{ payload.data(), payload.size() });
+			const auto unique = in[dir]["unique.nif"sv];
+			REQUIRE(unique);
+			REQUIRE(unique->size() == other.size());
+			REQUIRE(unique->data()[0] == static_cast<std::byte>(dir[0]));
+		}
+
+		bsa.archive_flags(bsa.archive_flags() | bsa::tes4::archive_flag::embedded_file_names);
+		REQUIRE(write(true).size() == write(false).size());
+	}
+
+	SECTION("the size of an archive can be measured without writing it")
+	{
+		bsa::tes4::archive bsa;
+		std::vector<std::byte> payload(0x10, std::byte{ 0x7F });
+		for (std::size_t i = 0; i < 0x100; ++i) {
+			bsa::tes4::directory d;
+			for (std::size_t j = 0; j < 0x10; ++j) {
+				bsa::tes4::file f;
+				f.set_data({ payload.data(), payload.size() });
+				REQUIRE(d.insert("file" + std::to_string(j) + ".nif", std::move(f)).second);
+			}
+			REQUIRE(bsa.insert("meshes\\dir" + std::to_string(i), std::move(d)).second);
+		}
+
+		for (const auto flags : {
+				 bsa::tes4::archive_flag::directory_strings | bsa::tes4::archive_flag::file_strings,
+				 bsa::tes4::archive_flag::directory_strings | bsa::tes4::archive_flag::file_strings |
+					 bsa::tes4::archive_flag::xbox_archive,
+				 bsa::tes4::archive_flag::embedded_file_names | bsa::tes4::archive_flag::xbox_archive,
+			 }) {
+			bsa.archive_flags(flags);
+			for (const auto version : { bsa::tes4::version::tes4, bsa::tes4::version::sse }) {
+				binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+				bsa.write(os, version);
+				const auto& buffer = os.get<binary_io::memory_ostream>().rdbuf();
+				REQUIRE(bsa.measure(version).size == buffer.size());
+				REQUIRE(bsa.verify_offsets(version));
+
+				bsa::tes4::archive in;
+				REQUIRE(in.read({ buffer.data(), buffer.size() }) == version);
+				REQUIRE(in.size() == bsa.size());
+				for (const auto& [key, dir] : bsa) {
+					const auto d = in[key.name()];
+					REQUIRE(d);
+					REQUIRE(d->size() == dir.size());
+				}
+			}
+		}
+	}
+
+	SECTION("payloads can be aligned when writing")
+	{
+		const auto version = bsa::tes4::version::sse;
+		bsa::tes4::archive bsa;
+		bsa.archive_flags(
+			bsa::tes4::archive_flag::directory_strings |
+			bsa::tes4::archive_flag::file_strings |
+			bsa::tes4::archive_flag::embedded_file_names);
+
+		std::vector<std::vector<std::byte>> payloads;
+		bsa::tes4::directory d;
+		for (const auto size : { 0x10u, 0x1'234u, 0x20u, 0x3'000u }) {
+			auto& payload = payloads.emplace_back(size, static_cast<std::byte>(size));
+			bsa::tes4::file f;
+			f.set_data({ payload.data(), payload.size() });
+			REQUIRE(d.insert("file" + std::to_string(size) + ".bin", std::move(f)).second);
+		}
+		REQUIRE(bsa.insert("dir"sv, std::move(d)).second);
+
+		const bsa::tes4::write_options options{
+			.alignment = 0x1'000,
+			.alignment_threshold = 0x100,
+		};
+		const auto packed = bsa.measure(version);
+		const auto aligned = bsa.measure(version, options);
+		REQUIRE(packed.padding == 0);
+		REQUIRE(aligned.padding > 0);
+		REQUIRE(aligned.size == packed.size + aligned.padding);
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		bsa.write(os, version, options);
+		const auto& buffer = os.get<binary_io::memory_ostream>().rdbuf();
+		REQUIRE(buffer.size() == aligned.size);
+
+		bsa::tes4::archive in;
+		REQUIRE(in.read({ buffer.data(), buffer.size() }, bsa::copy_type::shallow) == version);
+		for (const auto& payload : payloads) {
+			const auto file = in["dir"sv]["file" + std::to_string(payload.size()) + ".bin"];
+			REQUIRE(file);
+			assert_byte_equality(file->as_bytes(), std::span{ payload.data(), payload.size() });
+			const auto offset = static_cast<std::size_t>(file->data() - buffer.data());
+			if (payload.size() >= options.alignment_threshold) {
+				REQUIRE(offset % options.alignment == 0);
+			}
+		}
+	}
+
+	SECTION("payloads can be laid out in a caller-provided order")
+	{
+		const auto version = bsa::tes4::version::sse;
+		bsa::tes4::archive bsa;
+		bsa.archive_flags(
+			bsa::tes4::archive_flag::directory_strings |
+			bsa::tes4::archive_flag::file_strings);
+
+		std::vector<std::vector<std::byte>> payloads;
+		for (const auto dir : { "meshes"sv, "textures"sv, "sound"sv }) {
+			bsa::tes4::directory d;
+			for (const auto name : { "a.bin"sv, "b.bin"sv, "c.bin"sv }) {
+				auto& payload = payloads.emplace_back(0x10, static_cast<std::byte>(payloads.size()));
+				bsa::tes4::file f;
+				f.set_data({ payload.data(), payload.size() });
+				REQUIRE(d.insert(name, std::move(f)).second);
+			}
+			REQUIRE(bsa.insert(dir, std::move(d)).second);
+		}
+
+		const std::array<std::string, 5> order{
+			"sound/c.bin",
+			"Textures\\A.bin",
+			"missing/file.bin",
+			"meshes/b.bin",
+			"sound/c.bin",
+		};
+		const bsa::tes4::write_options options{ .payload_order = order };
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		bsa.write(os, version, options);
+		const auto& buffer = os.get<binary_io::memory_ostream>().rdbuf();
+		REQUIRE(buffer.size() == bsa.measure(version).size);
+
+		bsa::tes4::archive in;
+		REQUIRE(in.read({ buffer.data(), buffer.size() }, bsa::copy_type::shallow) == version);
+		const auto offset = [&](std::string_view a_dir, std::string_view a_file) {
+			const auto file = in[a_dir][a_file];
+			REQUIRE(file);
+			assert_byte_equality(file->as_bytes(), bsa[a_dir][a_file]->as_bytes());
+			return file->data() - buffer.data();
+		};
+
+		REQUIRE(offset("sound"sv, "c.bin"sv) < offset("textures"sv, "a.bin"sv));
+		REQUIRE(offset("textures"sv, "a.bin"sv) < offset("meshes"sv, "b.bin"sv));
+		for (const auto dir : { "meshes"sv, "textures"sv, "sound"sv }) {
+			for (const auto name : { "a.bin"sv, "b.bin"sv, "c.bin"sv }) {
+				if ((dir == "sound"sv && name == "c.bin"sv) ||
+					(dir == "textures"sv && name == "a.bin"sv)) {
+					continue;
+				}
+				REQUIRE(offset(dir, name) >= offset("meshes"sv, "b.bin"sv));
+			}
+		}
+	}
+
+	SECTION("archives can be updated in place")
+	{
+		const std::filesystem::path root{ "tes4_compression_test"sv };
+		// declared first, so it outlives the archives which map it
+		const temporary_path temporary{ "update.bsa"sv };
+		const auto& path = temporary.get();
+		const auto version = bsa::tes4::version::sse;
+		{
+			bsa::tes4::archive src;
+			REQUIRE(src.read(root / "test_105.bsa"sv) == version);
+			src.write(path, version);
+		}
+
+		bsa::tes4::archive bsa;
+		REQUIRE(bsa.read(path) == version);
+		const auto original = std::filesystem::file_size(path);
+
+		std::array<std::byte, 0x100> payload{};
+		payload.fill(std::byte{ 0x42 });
+		const auto replace = [&](std::string_view a_name) {
+			bsa::tes4::file f;
+			f.set_data({ payload.data(), payload.size() });
+			bsa["."sv]->erase(a_name);
+			REQUIRE(bsa["."sv]->insert(a_name, std::move(f)).second);
+		};
+
+		const auto verify = [&](std::initializer_list<std::string_view> a_replaced) {
+			bsa::tes4::archive in;
+			REQUIRE(in.read(path) == version);
+			REQUIRE(in["."sv]->size() == a_replaced.size() + 1);
+			for (const auto name : a_replaced) {
+				const auto file = in["."sv][name];
+				REQUIRE(file);
+				assert_byte_equality(file->as_bytes(), std::span{ payload.data(), payload.size() });
+			}
+
+			const auto disk = map_file(root / "Preview.png"sv);
+			bsa::scratch_buffer buffer;
+			assert_byte_equality(
+				in["."sv]["Preview.png"sv]->extract(version, buffer),
+				std::span{ disk.data(), disk.size() });
+		};
+
+		replace("License.txt"sv);
+		bsa.update(path, version, 1.0);
+		const auto updated = std::filesystem::file_size(path);
+		REQUIRE(updated >= original + payload.size());
+		REQUIRE(updated < original + 2 * payload.size());
+		verify({ "License.txt"sv });
+
+		replace("New.txt"sv);
+		bsa.update(path, version, 1.0);
+		verify({ "License.txt"sv, "New.txt"sv });
+
+		bsa.update(path, version, 0.0);
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		bsa.write(os, version);
+		REQUIRE(std::filesystem::file_size(path) == os.get<binary_io::memory_ostream>().rdbuf().size());
+		verify({ "License.txt"sv, "New.txt"sv });
+
+	}
+
+	SECTION("we can extract files into a reusable buffer")
+	{
+		const std::filesystem::path root{ "tes4_compression_test"sv };
+
+		bsa::tes4::archive bsa;
+		const auto version = bsa.read(root / "test_105.bsa"sv);
+
+		bsa::scratch_buffer buffer;
+		const auto extract = [&](std::string_view a_name) {
+			const auto file = bsa["."sv][a_name];
+			REQUIRE(file);
+			REQUIRE(file->compressed());
+
+			const auto disk = map_file(root / a_name);
+			assert_byte_equality(
+				file->extract(version, buffer),
+				std::span{ disk.data(), disk.size() });
+			REQUIRE(buffer.capacity() >= disk.size());
+		};
+
+		extract("License.txt"sv);
+		extract("Preview.png"sv);
+		const auto capacity = buffer.capacity();
+		extract("License.txt"sv);
+		REQUIRE(buffer.capacity() == capacity);
+
+		const std::array<std::byte, 1u << 4> payload{};
+		bsa::tes4::file f;
+		f.set_data({ payload.data(), payload.size() });
+		const auto bytes = f.extract(version, buffer);
+		REQUIRE(bytes.data() == payload.data());
+		REQUIRE(bytes.size() == payload.size());
+	}
+
+	SECTION("we can read a range of the contents of files")
+	{
+		const std::filesystem::path root{ "tes4_compression_test"sv };
+
+		for (const auto archive : { "test_104.bsa"sv, "test_105.bsa"sv }) {
+			bsa::tes4::archive bsa;
+			const auto version = bsa.read(root / archive);
+
+			const auto file = bsa["."sv]["Preview.png"sv];
+			REQUIRE(file);
+			REQUIRE(file->compressed());
+
+			const auto disk = map_file(root / "Preview.png"sv);
+			const std::span original{ disk.data(), disk.size() };
+
+			bsa::scratch_buffer buffer;
+			assert_byte_equality(
+				file->read_range(version, 0, 0x40, buffer),
+				original.subspan(0, 0x40));
+			assert_byte_equality(
+				file->read_range(version, 0x9'345, 0x1'000, buffer),
+				original.subspan(0x9'345, 0x1'000));
+			assert_byte_equality(
+				file->read_range(version, original.size() - 0x10, 0x100, buffer),
+				original.subspan(original.size() - 0x10));
+			REQUIRE(file->read_range(version, original.size() + 1, 0x10, buffer).empty());
+		}
+
+		const std::array<std::byte, 1u << 4> payload{};
+		bsa::tes4::file f;
+		f.set_data({ payload.data(), payload.size() });
+		bsa::scratch_buffer buffer;
+		const auto bytes = f.read_range(bsa::tes4::version::sse, 4, 8, buffer);
+		REQUIRE(bytes.data() == payload.data() + 4);
+		REQUIRE(bytes.size() == 8);
+	}
+
+	SECTION("sse files can be compressed using independent blocks")
+	{
+		const auto payload = make_compressible_payload(1u << 22u);
+
+		const auto version = bsa::tes4::version::sse;
+		const auto independent = [](const bsa::tes4::file& a_file) {
+			return (std::to_integer<std::uint8_t>(a_file.as_bytes()[4]) & (1u << 5u)) != 0;
+		};
+
+		for (const auto codec : {
+				 bsa::tes4::compression_codec::normal,
+				 bsa::tes4::compression_codec::independent_blocks }) {
+			bsa::tes4::file f;
+			f.set_data({ payload.data(), payload.size() });
+			f.compress(version, codec);
+			REQUIRE(f.compressed());
+			REQUIRE(independent(f) == (codec == bsa::tes4::compression_codec::independent_blocks));
+
+			for (const auto policy : { bsa::execution_policy::sequential, bsa::execution_policy::parallel }) {
+				std::vector<std::byte> out(f.decompressed_size());
+				f.decompress_into(version, { out.data(), out.size() }, codec, policy);
+				assert_byte_equality(
+					std::span{ out.data(), out.size() },
+					std::span{ payload.data(), payload.size() });
+			}
+
+			bsa::scratch_buffer buffer;
+			assert_byte_equality(
+				f.read_range(version, 0x123'456, 0x10'000, buffer),
+				std::span{ payload.data() + 0x123'456, 0x10'000 });
+		}
+	}
+
+	SECTION("large files can be compressed in parallel")
+	{
+		const auto payload = make_compressible_payload((1u << 21u) + 0x123);
+
+		for (const auto version : { bsa::tes4::version::tes4, bsa::tes4::version::tes5 }) {
+			bsa::tes4::file f;
+			f.set_data({ payload.data(), payload.size() });
+			f.compress(version, bsa::tes4::compression_codec::normal, bsa::execution_policy::parallel);
+			REQUIRE(f.compressed());
+			REQUIRE(f.size() < payload.size());
+
+			// blocks deflated in parallel end on sync flushes, so the stream differs from a serial one
+			bsa::tes4::file serial;
+			serial.set_data({ payload.data(), payload.size() });
+			serial.compress(version);
+			REQUIRE(f.size() != serial.size());
+
+			f.decompress(version);
+			assert_byte_equality(
+				f.as_bytes(),
+				std::span{ payload.data(), payload.size() });
+		}
+	}
+
+	SECTION("files which don't benefit from compression can be stored raw")
+	{
+		const std::filesystem::path root{ "tes4_compression_test"sv };
+		constexpr auto version = bsa::tes4::version::sse;
+
+		constexpr std::array files{
+			std::make_pair("License.txt"sv, true),
+			std::make_pair("Preview.png"sv, false),
+		};
+
+		bsa::tes4::archive bsa;
+		bsa.archive_flags(
+			bsa::tes4::archive_flag::compressed |
+			bsa::tes4::archive_flag::directory_strings |
+			bsa::tes4::archive_flag::file_strings);
+
+		std::vector<mmio::mapped_file_source> sources;
+		bsa::tes4::directory d;
+		for (const auto& [name, compressible] : files) {
+			const auto& src = sources.emplace_back(map_file(root / name));
+			bsa::tes4::file f;
+			f.set_data({ reinterpret_cast<const std::byte*>(src.data()), src.size() });
+			REQUIRE(f.try_compress(version) == compressible);
+			REQUIRE(f.compressed() == compressible);
+			REQUIRE(d.insert(name, std::move(f)).second);
+		}
+		REQUIRE(bsa.insert("."sv, std::move(d)).second);
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		bsa.write(os, version);
+
+		bsa::tes4::archive in;
+		REQUIRE(in.read(os.get<binary_io::memory_ostream>().rdbuf()) == version);
+		REQUIRE(in.compressed());
+		for (std::size_t i = 0; i < files.size(); ++i) {
+			const auto& [name, compressible] = files[i];
+			const auto file = in["."sv][name];
+			REQUIRE(file);
+			REQUIRE(file->compressed() == compressible);
+			if (compressible) {
+				file->decompress(version);
+			}
+			assert_byte_equality(file->as_bytes(), std::span{ sources[i].data(), sources[i].size() });
+		}
+	}
+
 	SECTION("we can validate the offsets within an archive (<2gb)")
 	{
 		bsa::tes4::archive bsa;
@@ -380,6 +939,15 @@ TEST_CASE("bsa::tes4::archive", "[src][tes4][archive]")
 
 		add({ 1 }, little);
 		REQUIRE(!verify());
+
+		// offsets past 4 GiB must not wrap around into range
+		bsa.clear();
+		add({ 0 }, little);
+		const bsa::tes4::write_options aligned{ .alignment = std::size_t{ 1 } << 32 };
+		REQUIRE(bsa.verify_offsets(bsa::tes4::version::tes4));
+		REQUIRE(!bsa.verify_offsets(bsa::tes4::version::tes4, aligned));
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		REQUIRE_THROWS_AS(bsa.write(os, bsa::tes4::version::tes4, aligned), bsa::exception);
 	}
 
 	SECTION("we can write archives with a variety of flags")
@@ -519,6 +1087,56 @@ TEST_CASE("bsa::tes4::archive", "[src][tes4][archive]")
 				bsa.read(root / filename),
 				make_substr_matcher(type));
 		}
+
+		// a directory count which can't fit in the archive is rejected before it's allocated for
+		bsa::tes4::archive src;
+		src.archive_flags(bsa::tes4::archive_flag::directory_strings);
+		const std::array<std::byte, 0x10> payload{};
+		bsa::tes4::file f;
+		f.set_data({ payload.data(), payload.size() });
+		bsa::tes4::directory d;
+		REQUIRE(d.insert("test.nif"sv, std::move(f)).second);
+		REQUIRE(src.insert("meshes"sv, std::move(d)).second);
+
+		binary_io::any_ostream os{ std::in_place_type<binary_io::memory_ostream> };
+		src.write(os, bsa::tes4::version::sse);
+		auto bytes = os.get<binary_io::memory_ostream>().rdbuf();
+		const auto count = std::uint32_t{ 0xFFFF'FFFF };
+		std::memcpy(bytes.data() + 0x10, &count, sizeof(count));
+
+		bsa::tes4::archive bsa;
+		REQUIRE_THROWS_AS(bsa.read({ bytes.data(), bytes.size() }), binary_io::buffer_exhausted);
+	}
+
+	SECTION("archives can be built from many threads at once")
+	{
+		constexpr std::size_t directories = 8;
+		constexpr std::size_t files = 64;
+		const std::vector<std::byte> payload(directories * files);
+
+		bsa::tes4::archive_builder builder{ 4 };
+		REQUIRE(builder.insert("dir"sv, "file.txt"sv, bsa::tes4::file{}));
+		REQUIRE(!builder.insert("dir"sv, "file.txt"sv, bsa::tes4::file{}));
+		static_cast<void>(builder.finalize());
+
+		insert_concurrently(payload.size(), [&](std::size_t a_idx) {
+			bsa::tes4::file f;
+			f.set_data(std::span{ payload.data() + a_idx, 1 });
+			return builder.insert(
+				"dir" + std::to_string(a_idx / files),
+				"file" + std::to_string(a_idx % files) + ".txt",
+				std::move(f));
+		});
+
+		const auto bsa = builder.finalize();
+		REQUIRE(bsa.size() == directories);
+		for (std::size_t i = 0; i < payload.size(); ++i) {
+			const auto file = bsa["dir" + std::to_string(i / files)]["file" + std::to_string(i % files) + ".txt"];
+			REQUIRE(file);
+			REQUIRE(file->data() == payload.data() + i);
+		}
+
+		REQUIRE(builder.finalize().empty());
 	}
 
 	SECTION("we can use multi-level indexing even when the given directory doesn't exist")
@@ -5,15 +5,21 @@
 #endif
 
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <filesystem>
 #include <functional>
 #include <initializer_list>
+#include <random>
 #include <span>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -121,6 +127,115 @@ inline void assert_byte_equality(
 	REQUIRE(std::memcmp(a_lhs.data(), a_rhs.data(), a_lhs.size()) == 0);
 }
 
+// A uniquely named path within the temporary directory, which is removed once it goes out of scope,
+//	even if the test fails beforehand.
+class temporary_path final
+{
+public:
+	explicit temporary_path(std::string_view a_filename)
+	{
+		std::random_device rd;
+		_path = std::filesystem::temp_directory_path() /
+		        ("bsa-test-" + std::to_string(rd()) + '-' + std::string(a_filename));
+	}
+
+	temporary_path(const temporary_path&) = delete;
+	temporary_path& operator=(const temporary_path&) = delete;
+
+	~temporary_path() noexcept
+	{
+		std::error_code ec;
+		std::filesystem::remove(_path, ec);
+	}
+
+	[[nodiscard]] const std::filesystem::path& get() const noexcept { return _path; }
+
+private:
+	std::filesystem::path _path;
+};
+
+// Generates a payload of pseudo-random letters, which compresses well but not trivially.
+[[nodiscard]] inline auto make_compressible_payload(std::size_t a_size)
+	-> std::vector<std::byte>
+{
+	std::vector<std::byte> result(a_size);
+	std::uint32_t seed = 0;
+	for (auto& byte : result) {
+		seed = seed * 1664525u + 1013904223u;
+		byte = static_cast<std::byte>((seed >> 28u) + 'a');
+	}
+	return result;
+}
+
+// Invokes `a_insert` once for every index in [0, a_count), spread across several threads at once,
+//	and checks that every invocation reports success.
+inline void insert_concurrently(
+	std::size_t a_count,
+	const std::function<bool(std::size_t)>& a_insert)
+{
+	constexpr std::size_t threads = 4;
+	std::atomic_size_t failures{ 0 };
+	{
+		std::vector<std::jthread> workers;
+		for (std::size_t t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t]() {
+				for (std::size_t i = t; i < a_count; i += threads) {
+					if (!a_insert(i)) {
+						++failures;
+					}
+				}
+			});
+		}
+	}
+	REQUIRE(failures == 0);
+}
+
+// Builds the same flat archive concurrently with one shard and with many, and checks that both
+//	finalize into identical archives, whose records are in key order.
+template <class Archive>
+void test_flat_builder(
+	std::function<std::string(std::size_t)> a_name,
+	std::function<typename Archive::mapped_type(std::span<const std::byte>)> a_makeFile,
+	std::function<const std::byte*(const typename Archive::mapped_type&)> a_data)
+{
+	using builder_t = bsa::components::sharded_builder<Archive>;
+	const std::vector<std::byte> payload(256);
+
+	builder_t one{ 1 };
+	builder_t many;
+	insert_concurrently(payload.size(), [&](std::size_t a_idx) {
+		const auto name = a_name(a_idx);
+		return one.insert(name, a_makeFile({ payload.data() + a_idx, 1 })) &&
+		       many.insert(name, a_makeFile({ payload.data() + a_idx, 1 }));
+	});
+	REQUIRE(!many.insert(a_name(0), typename Archive::mapped_type{}));
+
+	const auto lhs = one.finalize(bsa::execution_policy::sequential);
+	const auto rhs = many.finalize();
+	REQUIRE(lhs.size() == payload.size());
+	REQUIRE(rhs.size() == payload.size());
+	for (std::size_t i = 0; i < payload.size(); ++i) {
+		const auto file = rhs[a_name(i)];
+		REQUIRE(file);
+		REQUIRE(a_data(*file) == payload.data() + i);
+	}
+
+	// records are finalized in key order, whatever the shards or threads were
+	const typename Archive::key_type* last = nullptr;
+	auto it = lhs.begin();
+	for (const auto& [key, file] : rhs) {
+		REQUIRE(it != lhs.end());
+		REQUIRE(it->first == key);
+		if (last) {
+			REQUIRE(*last < key);
+		}
+		last = &key;
+		++it;
+	}
+
+	REQUIRE(many.finalize().empty());
+}
+
 template <class Archive>
 void test_in_memory_buffer(
 	std::string_view a_archiveName,